@@ -5,7 +5,7 @@
 #include <QProgressDialog>
 #include <QStyle>
 #include <QStyleHints>
-#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
 #include <toml.hpp>
 
 #include "./ui_mainWindow.h"
@@ -131,6 +131,43 @@ void MainWindow::LoadSettings() {
     useSeparateUpdate = toml::find_or<bool>(data, "Settings", "UseSeparateUpdateFolder", true);
     ui->separateUpdateCheckBox->setChecked(useSeparateUpdate);
 
+    extractorConfig.reader_threads = toml::find_or<u32>(data, "Extraction", "ReaderThreads",
+                                                        extractorConfig.reader_threads);
+    extractorConfig.decrypt_threads = toml::find_or<u32>(data, "Extraction", "DecryptThreads",
+                                                         extractorConfig.decrypt_threads);
+    extractorConfig.inflate_threads = toml::find_or<u32>(data, "Extraction", "InflateThreads",
+                                                         extractorConfig.inflate_threads);
+    extractorConfig.writer_threads = toml::find_or<u32>(data, "Extraction", "WriterThreads",
+                                                        extractorConfig.writer_threads);
+    extractorConfig.queue_depth = toml::find_or<u32>(data, "Extraction", "QueueDepth",
+                                                     extractorConfig.queue_depth);
+    extractorConfig.use_async_io = toml::find_or<bool>(data, "Extraction", "UseAsyncIO",
+                                                       extractorConfig.use_async_io);
+    extractorConfig.io_queue_depth = toml::find_or<u32>(data, "Extraction", "AsyncIOQueueDepth",
+                                                        extractorConfig.io_queue_depth);
+    extractorConfig.write_combine_size = toml::find_or<u64>(
+        data, "Extraction", "WriteCombineSize", extractorConfig.write_combine_size);
+    extractorConfig.commit_interval = toml::find_or<u64>(data, "Extraction", "CommitInterval",
+                                                         extractorConfig.commit_interval);
+    const auto cache_eviction = toml::find_or<std::string>(data, "Extraction", "CacheEviction",
+                                                           std::string{"input"});
+    if (cache_eviction == "none") {
+        extractorConfig.cache_eviction = CacheEviction::None;
+    } else if (cache_eviction == "all") {
+        extractorConfig.cache_eviction = CacheEviction::InputAndOutput;
+    } else {
+        extractorConfig.cache_eviction = CacheEviction::Input;
+    }
+    extractorConfig.verify_digests = toml::find_or<bool>(data, "Extraction", "VerifyDigests",
+                                                         extractorConfig.verify_digests);
+    const auto inflate_backend = toml::find_or<std::string>(data, "Extraction", "InflateBackend",
+                                                            std::string{"builtin"});
+    if (inflate_backend == "zlib") {
+        extractorConfig.inflate_backend = PfscInflateBackend::Zlib;
+    } else {
+        extractorConfig.inflate_backend = PfscInflateBackend::BuiltIn;
+    }
+
     if (data.contains("Paths")) {
         const toml::value& launcher = data.at("Paths");
         outputPath = toml::find_fs_path_or(launcher, "outputPath", {});
@@ -188,6 +225,29 @@ void MainWindow::SaveSettings() {
     data["Paths"]["outputPath"] = std::string{fmt::UTF(outputPath.u8string()).data};
     data["Paths"]["dlcPath"] = std::string{fmt::UTF(dlcPath.u8string()).data};
     data["Settings"]["UseSeparateUpdateFolder"] = useSeparateUpdate;
+    data["Extraction"]["ReaderThreads"] = extractorConfig.reader_threads;
+    data["Extraction"]["DecryptThreads"] = extractorConfig.decrypt_threads;
+    data["Extraction"]["InflateThreads"] = extractorConfig.inflate_threads;
+    data["Extraction"]["WriterThreads"] = extractorConfig.writer_threads;
+    data["Extraction"]["QueueDepth"] = extractorConfig.queue_depth;
+    data["Extraction"]["UseAsyncIO"] = extractorConfig.use_async_io;
+    data["Extraction"]["AsyncIOQueueDepth"] = extractorConfig.io_queue_depth;
+    data["Extraction"]["WriteCombineSize"] = extractorConfig.write_combine_size;
+    data["Extraction"]["CommitInterval"] = extractorConfig.commit_interval;
+    switch (extractorConfig.cache_eviction) {
+    case CacheEviction::None:
+        data["Extraction"]["CacheEviction"] = "none";
+        break;
+    case CacheEviction::Input:
+        data["Extraction"]["CacheEviction"] = "input";
+        break;
+    case CacheEviction::InputAndOutput:
+        data["Extraction"]["CacheEviction"] = "all";
+        break;
+    }
+    data["Extraction"]["VerifyDigests"] = extractorConfig.verify_digests;
+    data["Extraction"]["InflateBackend"] =
+        extractorConfig.inflate_backend == PfscInflateBackend::Zlib ? "zlib" : "builtin";
 
     std::ofstream file(settingsFile, std::ios::binary);
     file << data;
@@ -453,24 +513,23 @@ void MainWindow::InstallDragDropPkg(std::filesystem::path file) {
             // what else?
         }
 
-        if (!pkg.Extract(file, game_update_path, failreason)) {
+        if (!pkg.Extract(file, game_update_path, failreason, extractorConfig.inflate_backend)) {
             QMessageBox::critical(this, tr("PKG ERROR"), QString::fromStdString(failreason));
         } else {
-            int nfiles = pkg.GetNumberOfFiles();
-
-            if (nfiles > 0) {
-                QVector<int> indices;
-                for (int i = 0; i < nfiles; i++) {
-                    indices.append(i);
-                }
+            if (pkg.GetExtractionPlan().GetNumberOfFiles() > 0) {
+                Extractor extractor(pkg, extractorConfig);
+                const int nblocks = static_cast<int>(extractor.GetTotalBlocks());
 
                 QProgressDialog dialog;
                 dialog.setWindowTitle(tr("PKG Installation"));
                 dialog.setWindowModality(Qt::WindowModal);
                 QString extractmsg = QString(tr("Installing PKG"));
                 dialog.setLabelText(extractmsg);
-                dialog.setAutoClose(true);
-                dialog.setRange(0, nfiles);
+                // The bar can be full before Run returns, the finished handler closes the
+                // dialog once the extraction is really over.
+                dialog.setAutoClose(false);
+                dialog.setAutoReset(false);
+                dialog.setRange(0, nblocks);
 
                 bool isSystemDarkMode;
 #if defined(__linux__)
@@ -504,7 +563,22 @@ void MainWindow::InstallDragDropPkg(std::filesystem::path file) {
                 }
 
                 QFutureWatcher<void> futureWatcher;
-                connect(&futureWatcher, &QFutureWatcher<void>::finished, this, [=, this]() {
+                connect(&futureWatcher, &QFutureWatcher<void>::finished, this, [&]() {
+                    dialog.close();
+                    const std::string error = extractor.GetError();
+                    if (!error.empty()) {
+                        QMessageBox::critical(this, tr("PKG ERROR"), QString::fromStdString(error));
+                        return;
+                    }
+                    if (AnyDigestFailed(extractor.GetDigestReport())) {
+                        const auto report = FormatDigestReport(extractor.GetDigestReport());
+                        QMessageBox::warning(this,
+                                             tr("PKG Verification"),
+                                             tr("The PKG does not match its digests and may be "
+                                                "damaged:\n\n%1")
+                                                 .arg(QString::fromStdString(report)));
+                    }
+
                     QString path;
 
                     // We want to show the parent path instead of the full path
@@ -544,10 +618,18 @@ void MainWindow::InstallDragDropPkg(std::filesystem::path file) {
                         &dialog,
                         &QProgressDialog::setValue);
 
-                futureWatcher.setFuture(
-                    QtConcurrent::map(indices, [&](int index) { pkg.ExtractFiles(index); }));
+                futureWatcher.setFuture(QtConcurrent::run([&](QPromise<void>& promise) {
+                    promise.setProgressRange(0, nblocks);
+                    extractor.Run([&](u64 blocks_written) {
+                        promise.setProgressValue(static_cast<int>(blocks_written));
+                        return !promise.isCanceled();
+                    });
+                }));
 
+                // Returns once the finished handler has run, or as soon as the user cancels.
                 dialog.exec();
+                // The extractor lives on this stack frame, let a cancelled run wind down first.
+                futureWatcher.waitForFinished();
             }
         }
     } else {
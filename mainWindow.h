@@ -1,6 +1,7 @@
 #include <QMainWindow>
 #include <filesystem>
 
+#include "src/extractor.h"
 #include "src/pkg.h"
 #include "src/psf.h"
 
@@ -38,6 +39,7 @@ private:
     std::filesystem::path pkgPath = "";
     std::filesystem::path tomlPath = "";
     std::filesystem::path settingsFile;
+    ExtractorConfig extractorConfig;
     PKG pkg;
     PSF psf;
 
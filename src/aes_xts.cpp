@@ -0,0 +1,228 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <array>
+#include <cstring>
+#include <cryptopp/aes.h>
+
+#include "aes_xts.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define AES_XTS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC always allows the AES intrinsics, GCC and Clang need them enabled per function so the
+// rest of the binary keeps running on CPUs without AES-NI.
+#if defined(AES_XTS_X86) && !defined(_MSC_VER)
+#define AES_XTS_TARGET __attribute__((target("aes,sse2")))
+#else
+#define AES_XTS_TARGET
+#endif
+
+namespace Common::AesXts {
+
+namespace {
+
+constexpr u64 SectorSize = 0x1000;
+constexpr u64 BlocksPerSector = SectorSize / 16;
+
+#ifdef AES_XTS_X86
+
+// Blocks decrypted together, enough to hide the latency of aesdec.
+constexpr u32 Interleave = 8;
+
+template <int Rcon>
+AES_XTS_TARGET __m128i ExpandKeyStep(__m128i key) {
+    const __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(key, Rcon), 0xFF);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+AES_XTS_TARGET void ExpandKey(const u8* key, __m128i* round_keys) {
+    round_keys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+    round_keys[1] = ExpandKeyStep<0x01>(round_keys[0]);
+    round_keys[2] = ExpandKeyStep<0x02>(round_keys[1]);
+    round_keys[3] = ExpandKeyStep<0x04>(round_keys[2]);
+    round_keys[4] = ExpandKeyStep<0x08>(round_keys[3]);
+    round_keys[5] = ExpandKeyStep<0x10>(round_keys[4]);
+    round_keys[6] = ExpandKeyStep<0x20>(round_keys[5]);
+    round_keys[7] = ExpandKeyStep<0x40>(round_keys[6]);
+    round_keys[8] = ExpandKeyStep<0x80>(round_keys[7]);
+    round_keys[9] = ExpandKeyStep<0x1B>(round_keys[8]);
+    round_keys[10] = ExpandKeyStep<0x36>(round_keys[9]);
+}
+
+// The equivalent inverse cipher runs the encryption schedule backwards through InvMixColumns.
+AES_XTS_TARGET void InvertKey(const __m128i* round_keys, __m128i* inverse_keys) {
+    inverse_keys[0] = round_keys[10];
+    for (int i = 1; i < 10; i++) {
+        inverse_keys[i] = _mm_aesimc_si128(round_keys[10 - i]);
+    }
+    inverse_keys[10] = round_keys[0];
+}
+
+AES_XTS_TARGET __m128i EncryptBlock(__m128i block, const __m128i* round_keys) {
+    block = _mm_xor_si128(block, round_keys[0]);
+    for (int i = 1; i < 10; i++) {
+        block = _mm_aesenc_si128(block, round_keys[i]);
+    }
+    return _mm_aesenclast_si128(block, round_keys[10]);
+}
+
+// Multiplies the tweak by x in GF(2^128). Each 32-bit lane shifts left on its own, the bit
+// that falls out of a lane is carried into the next one and the top bit folds back as 0x87.
+AES_XTS_TARGET __m128i DoubleTweak(__m128i tweak) {
+    const __m128i carry = _mm_shuffle_epi32(_mm_srai_epi32(tweak, 31), 0x93);
+    const __m128i feedback = _mm_and_si128(carry, _mm_set_epi32(1, 1, 1, 0x87));
+    return _mm_xor_si128(_mm_slli_epi32(tweak, 1), feedback);
+}
+
+AES_XTS_TARGET void ExpandSessionKeys(const u8* data_key, const u8* tweak_key,
+                                      u8* tweak_round_keys, u8* decrypt_round_keys) {
+    __m128i tweak_keys[11];
+    __m128i data_keys[11];
+    __m128i decrypt_keys[11];
+    ExpandKey(tweak_key, tweak_keys);
+    ExpandKey(data_key, data_keys);
+    InvertKey(data_keys, decrypt_keys);
+    for (int i = 0; i < 11; i++) {
+        _mm_store_si128(reinterpret_cast<__m128i*>(tweak_round_keys) + i, tweak_keys[i]);
+        _mm_store_si128(reinterpret_cast<__m128i*>(decrypt_round_keys) + i, decrypt_keys[i]);
+    }
+}
+
+AES_XTS_TARGET void DecryptSectorsAesNi(const u8* tweak_round_keys, const u8* decrypt_round_keys,
+                                        const u8* src, u8* dst, u64 num_sectors, u64 sector) {
+    __m128i tweak_keys[11];
+    __m128i decrypt_keys[11];
+    const auto* stored_tweak_keys = reinterpret_cast<const __m128i*>(tweak_round_keys);
+    const auto* stored_decrypt_keys = reinterpret_cast<const __m128i*>(decrypt_round_keys);
+    for (int i = 0; i < 11; i++) {
+        tweak_keys[i] = _mm_load_si128(stored_tweak_keys + i);
+        decrypt_keys[i] = _mm_load_si128(stored_decrypt_keys + i);
+    }
+
+    for (u64 s = 0; s < num_sectors; s++) {
+        const __m128i index = _mm_set_epi64x(0, static_cast<s64>(sector + s));
+        __m128i tweak = EncryptBlock(index, tweak_keys);
+
+        const u8* in = src + s * SectorSize;
+        u8* out = dst + s * SectorSize;
+        for (u64 offset = 0; offset < SectorSize; offset += Interleave * 16) {
+            __m128i tweaks[Interleave];
+            __m128i blocks[Interleave];
+            for (u32 i = 0; i < Interleave; i++) {
+                tweaks[i] = tweak;
+                tweak = DoubleTweak(tweak);
+                const __m128i block =
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + offset + i * 16));
+                blocks[i] = _mm_xor_si128(_mm_xor_si128(block, tweaks[i]), decrypt_keys[0]);
+            }
+            for (int round = 1; round < 10; round++) {
+                for (u32 i = 0; i < Interleave; i++) {
+                    blocks[i] = _mm_aesdec_si128(blocks[i], decrypt_keys[round]);
+                }
+            }
+            for (u32 i = 0; i < Interleave; i++) {
+                blocks[i] = _mm_aesdeclast_si128(blocks[i], decrypt_keys[10]);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + offset + i * 16),
+                                 _mm_xor_si128(blocks[i], tweaks[i]));
+            }
+        }
+    }
+}
+
+static_assert(BlocksPerSector % Interleave == 0);
+
+#endif
+
+// Whitens a whole sector with its tweaks and hands it to Crypto++ in one call, which lets the
+// library pick its own accelerated path. The output whitening is folded into that call.
+void DecryptSectorsPortable(const CryptoPP::AES::Encryption& tweak_cipher,
+                            const CryptoPP::AES::Decryption& data_cipher, const u8* src, u8* dst,
+                            u64 num_sectors, u64 sector) {
+    std::array<u64, SectorSize / 8> tweaks;
+    std::array<u64, SectorSize / 8> buffer;
+    for (u64 s = 0; s < num_sectors; s++) {
+        std::array<u64, 2> tweak{sector + s, 0};
+        tweak_cipher.ProcessBlock(reinterpret_cast<CryptoPP::byte*>(tweak.data()));
+        for (u64 i = 0; i < BlocksPerSector; i++) {
+            tweaks[i * 2] = tweak[0];
+            tweaks[i * 2 + 1] = tweak[1];
+            const u64 feedback = (tweak[1] >> 63) ? 0x87 : 0;
+            tweak[1] = (tweak[1] << 1) | (tweak[0] >> 63);
+            tweak[0] = (tweak[0] << 1) ^ feedback;
+        }
+
+        std::memcpy(buffer.data(), src + s * SectorSize, SectorSize);
+        for (u64 i = 0; i < buffer.size(); i++) {
+            buffer[i] ^= tweaks[i];
+        }
+        data_cipher.AdvancedProcessBlocks(reinterpret_cast<const CryptoPP::byte*>(buffer.data()),
+                                          reinterpret_cast<const CryptoPP::byte*>(tweaks.data()),
+                                          dst + s * SectorSize, SectorSize,
+                                          CryptoPP::BlockTransformation::BT_AllowParallel);
+    }
+}
+
+} // Anonymous namespace
+
+bool HasHardwareSupport() {
+#ifdef AES_XTS_X86
+    static const bool supported = [] {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        const unsigned ecx = static_cast<unsigned>(info[2]);
+        const unsigned edx = static_cast<unsigned>(info[3]);
+#else
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+#endif
+        // AES-NI is ECX bit 25, SSE2 is EDX bit 26.
+        return (ecx & (1u << 25)) != 0 && (edx & (1u << 26)) != 0;
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+PfsCipherSession::PfsCipherSession(std::span<const u8, 16> data_key,
+                                   std::span<const u8, 16> tweak_key)
+    : hardware{HasHardwareSupport()} {
+#ifdef AES_XTS_X86
+    if (hardware) {
+        ExpandSessionKeys(data_key.data(), tweak_key.data(), tweak_round_keys.data(),
+                          decrypt_round_keys.data());
+        return;
+    }
+#endif
+    tweak_cipher.SetKey(tweak_key.data(), tweak_key.size());
+    data_cipher.SetKey(data_key.data(), data_key.size());
+}
+
+void PfsCipherSession::DecryptSectors(std::span<const u8> src, std::span<u8> dst,
+                                      u64 sector) const {
+    const u64 num_sectors = (src.size() < dst.size() ? src.size() : dst.size()) / SectorSize;
+#ifdef AES_XTS_X86
+    if (hardware) {
+        DecryptSectorsAesNi(tweak_round_keys.data(), decrypt_round_keys.data(), src.data(),
+                            dst.data(), num_sectors, sector);
+        return;
+    }
+#endif
+    DecryptSectorsPortable(tweak_cipher, data_cipher, src.data(), dst.data(), num_sectors, sector);
+}
+
+} // namespace Common::AesXts
@@ -0,0 +1,46 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <cryptopp/aes.h>
+
+#include "types.h"
+
+namespace Common::AesXts {
+
+/// True if DecryptSectors runs on the AES-NI kernel rather than the portable one.
+bool HasHardwareSupport();
+
+/**
+ * Expanded AES-128-XTS key schedules for one PFS image. The keys are expanded once when the
+ * session is created and never modified afterwards, so a single session can be shared by every
+ * thread that decrypts sectors of the image.
+ */
+class PfsCipherSession final {
+public:
+    PfsCipherSession(std::span<const u8, 16> data_key, std::span<const u8, 16> tweak_key);
+
+    /**
+     * Decrypts whole 0x1000-byte sectors, where the tweak of each sector is its index starting
+     * at the given sector. Any trailing partial sector is ignored. src and dst may be the same
+     * buffer.
+     */
+    void DecryptSectors(std::span<const u8> src, std::span<u8> dst, u64 sector) const;
+
+private:
+    static constexpr std::size_t RoundKeysSize = 11 * 16;
+
+    bool hardware;
+    // Used by the AES-NI kernel: the tweak encryption and the inverse data schedules.
+    alignas(16) std::array<u8, RoundKeysSize> tweak_round_keys{};
+    alignas(16) std::array<u8, RoundKeysSize> decrypt_round_keys{};
+    // Used everywhere else. Crypto++ block ciphers only read their schedule when processing.
+    CryptoPP::AES::Encryption tweak_cipher;
+    CryptoPP::AES::Decryption data_cipher;
+};
+
+} // namespace Common::AesXts
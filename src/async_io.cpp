@@ -0,0 +1,115 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <cerrno>
+
+#include "async_io.h"
+
+#ifdef ENABLE_IO_URING
+#include <liburing.h>
+#else
+// Only ever held as a null pointer when io_uring support is compiled out.
+struct io_uring {};
+#endif
+
+#ifdef _MSC_VER
+#define fileno _fileno
+#endif
+
+namespace Common::FS {
+
+AsyncIO::AsyncIO(u32 queue_depth_) : queue_depth{queue_depth_ ? queue_depth_ : 1} {
+#ifdef ENABLE_IO_URING
+    auto new_ring = std::make_unique<io_uring>();
+    if (io_uring_queue_init(queue_depth, new_ring.get(), 0) == 0) {
+        ring = std::move(new_ring);
+    }
+#endif
+}
+
+AsyncIO::~AsyncIO() {
+#ifdef ENABLE_IO_URING
+    if (ring) {
+        // Buffers may be owned by the caller, wait for the kernel to let go of them.
+        while (in_flight != 0) {
+            Reap(true, [](u64, s64) {});
+        }
+        io_uring_queue_exit(ring.get());
+    }
+#endif
+}
+
+void AsyncIO::QueueRead(const IOFile& file, u64 offset, std::span<u8> buffer, u64 tag) {
+#ifdef ENABLE_IO_URING
+    if (ring) {
+        io_uring_sqe* sqe = io_uring_get_sqe(ring.get());
+        if (sqe == nullptr) {
+            io_uring_submit(ring.get());
+            sqe = io_uring_get_sqe(ring.get());
+        }
+        io_uring_prep_read(sqe, fileno(file.file), buffer.data(), buffer.size(), offset);
+        io_uring_sqe_set_data64(sqe, tag);
+        in_flight++;
+        return;
+    }
+#endif
+    completed.emplace_back(tag, static_cast<s64>(file.ReadAtRaw(offset, buffer.data(),
+                                                                buffer.size())));
+}
+
+void AsyncIO::QueueWrite(const IOFile& file, u64 offset, std::span<const u8> buffer, u64 tag) {
+#ifdef ENABLE_IO_URING
+    if (ring) {
+        io_uring_sqe* sqe = io_uring_get_sqe(ring.get());
+        if (sqe == nullptr) {
+            io_uring_submit(ring.get());
+            sqe = io_uring_get_sqe(ring.get());
+        }
+        io_uring_prep_write(sqe, fileno(file.file), buffer.data(), buffer.size(), offset);
+        io_uring_sqe_set_data64(sqe, tag);
+        in_flight++;
+        return;
+    }
+#endif
+    completed.emplace_back(tag, static_cast<s64>(file.WriteAtRaw(offset, buffer.data(),
+                                                                 buffer.size())));
+}
+
+void AsyncIO::Submit() {
+#ifdef ENABLE_IO_URING
+    if (ring) {
+        io_uring_submit(ring.get());
+    }
+#endif
+}
+
+void AsyncIO::Reap([[maybe_unused]] bool wait, const std::function<void(u64, s64)>& on_complete) {
+    [[maybe_unused]] const bool had_completed = !completed.empty();
+    for (const auto& [tag, result] : completed) {
+        on_complete(tag, result);
+    }
+    completed.clear();
+
+#ifdef ENABLE_IO_URING
+    if (!ring || in_flight == 0) {
+        return;
+    }
+
+    io_uring_cqe* cqe = nullptr;
+    if (wait && !had_completed) {
+        int result;
+        do {
+            result = io_uring_wait_cqe(ring.get(), &cqe);
+        } while (result == -EINTR);
+    }
+    while (io_uring_peek_cqe(ring.get(), &cqe) == 0) {
+        const u64 tag = io_uring_cqe_get_data64(cqe);
+        const s64 result = cqe->res;
+        io_uring_cqe_seen(ring.get(), cqe);
+        in_flight--;
+        on_complete(tag, result);
+    }
+#endif
+}
+
+} // namespace Common::FS
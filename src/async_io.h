@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "io_file.h"
+#include "types.h"
+
+struct io_uring;
+
+namespace Common::FS {
+
+/**
+ * Batched positional reads and writes. On Linux builds with ENABLE_IO_URING the requests are
+ * submitted through an io_uring so many of them are in flight at once. Everywhere else, or if
+ * the kernel refuses to set up a ring, each request completes synchronously when it is queued
+ * and Reap just hands back the stored results.
+ *
+ * Not thread-safe, every thread should own its own instance. Callers must keep at most
+ * GetQueueDepth() requests outstanding and keep the buffers alive until they are reaped.
+ */
+class AsyncIO final {
+public:
+    explicit AsyncIO(u32 queue_depth);
+    ~AsyncIO();
+
+    AsyncIO(const AsyncIO&) = delete;
+    AsyncIO& operator=(const AsyncIO&) = delete;
+
+    /// True if requests go through io_uring rather than the synchronous fallback.
+    bool IsAsync() const {
+        return ring != nullptr;
+    }
+
+    u32 GetQueueDepth() const {
+        return queue_depth;
+    }
+
+    bool HasPending() const {
+        return in_flight != 0 || !completed.empty();
+    }
+
+    void QueueRead(const IOFile& file, u64 offset, std::span<u8> buffer, u64 tag);
+    void QueueWrite(const IOFile& file, u64 offset, std::span<const u8> buffer, u64 tag);
+
+    /// Hands every queued request to the kernel.
+    void Submit();
+
+    /**
+     * Calls on_complete(tag, result) for each finished request, where result is the number of
+     * bytes transferred or a negative errno. If wait is set, blocks until at least one request
+     * has finished.
+     */
+    void Reap(bool wait, const std::function<void(u64, s64)>& on_complete);
+
+private:
+    std::unique_ptr<io_uring> ring;
+    u32 queue_depth;
+    u32 in_flight = 0;
+    std::vector<std::pair<u64, s64>> completed;
+};
+
+} // namespace Common::FS
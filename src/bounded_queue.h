@@ -0,0 +1,83 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace Common {
+
+/// Multi-producer, multi-consumer FIFO with a fixed capacity. Push blocks while the queue is
+/// full and Pop blocks while it is empty, which keeps a fast stage from running ahead of a slow
+/// one. Closing the queue wakes every waiter; consumers still drain what is left.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity_) : capacity{capacity_ ? capacity_ : 1} {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /// Returns false if the queue was closed before the item could be queued.
+    bool Push(T&& item) {
+        std::unique_lock lock{mutex};
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        lock.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    /// Returns std::nullopt once the queue is closed and empty.
+    std::optional<T> Pop() {
+        std::unique_lock lock{mutex};
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return item;
+    }
+
+    /// Returns std::nullopt immediately if the queue is empty.
+    std::optional<T> TryPop() {
+        std::unique_lock lock{mutex};
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        not_full.notify_one();
+        return item;
+    }
+
+    void Close() {
+        {
+            std::scoped_lock lock{mutex};
+            closed = true;
+        }
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<T> items;
+    std::size_t capacity;
+    bool closed = false;
+};
+
+} // namespace Common
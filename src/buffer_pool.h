@@ -0,0 +1,92 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "alignment.h"
+
+namespace Common {
+
+constexpr std::size_t CacheLineSize = 64;
+
+/// Allocator for scratch buffers. Allocations start on a cache line so no two buffers share
+/// one.
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(AlignUp(n * sizeof(T), CacheLineSize),
+                                              std::align_val_t{CacheLineSize}));
+    }
+
+    void deallocate(T* ptr, std::size_t) noexcept {
+        ::operator delete(ptr, std::align_val_t{CacheLineSize});
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const noexcept {
+        return true;
+    }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/// Keeps released buffers around for reuse, so a pipeline that passes buffers between threads
+/// reaches a steady state without touching the allocator. Buffers keep their size and contents
+/// while pooled. Acquire(size) resizes them, which zero-fills whatever part of the buffer grows,
+/// so the pipeline's buffers only pay for that until they have reached their largest size.
+template <typename T>
+class BufferPool {
+public:
+    explicit BufferPool(std::size_t max_buffers_) : max_buffers{max_buffers_} {}
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /// Returns a pooled buffer as it was released, or an empty one if none is left.
+    AlignedVector<T> Acquire() {
+        std::scoped_lock lock{mutex};
+        if (buffers.empty()) {
+            return {};
+        }
+        AlignedVector<T> buffer = std::move(buffers.back());
+        buffers.pop_back();
+        return buffer;
+    }
+
+    AlignedVector<T> Acquire(std::size_t size) {
+        AlignedVector<T> buffer = Acquire();
+        buffer.resize(size);
+        return buffer;
+    }
+
+    void Release(AlignedVector<T>&& buffer) {
+        if (buffer.capacity() == 0) {
+            return;
+        }
+        std::scoped_lock lock{mutex};
+        if (buffers.size() < max_buffers) {
+            buffers.push_back(std::move(buffer));
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<AlignedVector<T>> buffers;
+    std::size_t max_buffers;
+};
+
+} // namespace Common
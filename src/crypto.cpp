@@ -1,7 +1,11 @@
 // SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
 // SPDX-License-Identifier: GPL-2.0-or-later
 
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 #include "crypto.h"
 
@@ -69,73 +73,71 @@ CryptoPP::RSA::PrivateKey Crypto::DebugRifKeyset_init() {
     return privateKey;
 }
 
-void Crypto::RSA2048Decrypt(std::span<CryptoPP::byte, 32> dec_key,
-                            std::span<const CryptoPP::byte, 256> ciphertext,
-                            bool is_dk3) { // RSAES_PKCS1v15_
-    // Create an RSA decryptor
-    CryptoPP::RSA::PrivateKey privateKey;
+namespace {
+
+// Parsing a keyset into CryptoPP::Integers costs far more than the decryption itself, so each
+// decryptor is built on first use and kept. Decrypt only reads the key, which lets every
+// thread share them.
+const CryptoPP::RSAES_PKCS1v15_Decryptor& GetRsaDecryptor(bool is_dk3) {
     if (is_dk3) {
-        privateKey = key_pkg_derived_key3_keyset_init();
-    } else {
-        privateKey = FakeKeyset_keyset_init();
+        static const CryptoPP::RSAES_PKCS1v15_Decryptor dk3_decryptor(
+            Crypto::key_pkg_derived_key3_keyset_init());
+        return dk3_decryptor;
     }
+    static const CryptoPP::RSAES_PKCS1v15_Decryptor fake_decryptor(
+        Crypto::FakeKeyset_keyset_init());
+    return fake_decryptor;
+}
 
-    CryptoPP::RSAES_PKCS1v15_Decryptor rsaDecryptor(privateKey);
+// CBC decryption straight into the output. Every block is decrypted and XORed with the
+// ciphertext block before it, so past the first one they are all independent and Crypto++
+// can take them several at a time.
+void AesCbcDecrypt(std::span<const CryptoPP::byte, 32> ivkey,
+                   std::span<const CryptoPP::byte> ciphertext,
+                   std::span<CryptoPP::byte> decrypted) {
+    static constexpr std::size_t BlockSize = CryptoPP::AES::BLOCKSIZE;
+    const std::size_t length = std::min(ciphertext.size(), decrypted.size()) & ~(BlockSize - 1);
+    if (length == 0) {
+        return;
+    }
 
-    // Allocate memory for the decrypted data
-    std::array<CryptoPP::byte, 256> decrypted;
+    const CryptoPP::AES::Decryption aes(ivkey.data() + 16, CryptoPP::AES::DEFAULT_KEYLENGTH);
+    aes.ProcessAndXorBlock(ciphertext.data(), ivkey.data(), decrypted.data());
+    aes.AdvancedProcessBlocks(ciphertext.data() + BlockSize, ciphertext.data(),
+                              decrypted.data() + BlockSize, length - BlockSize,
+                              CryptoPP::BlockTransformation::BT_AllowParallel);
+}
 
-    // Perform the decryption
-    CryptoPP::AutoSeededRandomPool rng;
-    CryptoPP::DecodingResult result =
-        rsaDecryptor.Decrypt(rng, ciphertext.data(), decrypted.size(), decrypted.data());
+} // Anonymous namespace
+
+void Crypto::RSA2048Decrypt(std::span<CryptoPP::byte, 32> dec_key,
+                            std::span<const CryptoPP::byte, 256> ciphertext,
+                            bool is_dk3) { // RSAES_PKCS1v15_
+    // Blinding needs random numbers, seeding a pool is too slow to do for every key.
+    thread_local CryptoPP::AutoSeededRandomPool rng;
+
+    std::array<CryptoPP::byte, 256> decrypted;
+    GetRsaDecryptor(is_dk3).Decrypt(rng, ciphertext.data(), decrypted.size(), decrypted.data());
     std::copy(decrypted.begin(), decrypted.begin() + dec_key.size(), dec_key.begin());
 }
 
 void Crypto::ivKeyHASH256(std::span<const CryptoPP::byte, 64> cipher_input,
                           std::span<CryptoPP::byte, 32> ivkey_result) {
-    CryptoPP::SHA256 sha256;
-    std::array<CryptoPP::byte, CryptoPP::SHA256::DIGESTSIZE> hashResult;
-    auto array_sink = new CryptoPP::ArraySink(hashResult.data(), CryptoPP::SHA256::DIGESTSIZE);
-    auto filter = new CryptoPP::HashFilter(sha256, array_sink);
-    CryptoPP::ArraySource r(cipher_input.data(), cipher_input.size(), true, filter);
-    std::copy(hashResult.begin(), hashResult.begin() + ivkey_result.size(), ivkey_result.begin());
+    static_assert(CryptoPP::SHA256::DIGESTSIZE == 32);
+    CryptoPP::SHA256().CalculateDigest(ivkey_result.data(), cipher_input.data(),
+                                       cipher_input.size());
 }
 
 void Crypto::aesCbcCfb128Decrypt(std::span<const CryptoPP::byte, 32> ivkey,
                                  std::span<const CryptoPP::byte, 256> ciphertext,
                                  std::span<CryptoPP::byte, 256> decrypted) {
-    std::array<CryptoPP::byte, CryptoPP::AES::DEFAULT_KEYLENGTH> key;
-    std::array<CryptoPP::byte, CryptoPP::AES::DEFAULT_KEYLENGTH> iv;
-
-    std::copy(ivkey.begin() + 16, ivkey.begin() + 16 + key.size(), key.begin());
-    std::copy(ivkey.begin(), ivkey.begin() + iv.size(), iv.begin());
-
-    CryptoPP::AES::Decryption aesDecryption(key.data(), CryptoPP::AES::DEFAULT_KEYLENGTH);
-    CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv.data());
-
-    for (size_t i = 0; i < decrypted.size(); i += CryptoPP::AES::BLOCKSIZE) {
-        cbcDecryption.ProcessData(decrypted.data() + i, ciphertext.data() + i,
-                                  CryptoPP::AES::BLOCKSIZE);
-    }
+    AesCbcDecrypt(ivkey, ciphertext, decrypted);
 }
 
 void Crypto::aesCbcCfb128DecryptEntry(std::span<const CryptoPP::byte, 32> ivkey,
-                                      std::span<CryptoPP::byte> ciphertext,
+                                      std::span<const CryptoPP::byte> ciphertext,
                                       std::span<CryptoPP::byte> decrypted) {
-    std::array<CryptoPP::byte, CryptoPP::AES::DEFAULT_KEYLENGTH> key;
-    std::array<CryptoPP::byte, CryptoPP::AES::DEFAULT_KEYLENGTH> iv;
-
-    std::copy(ivkey.begin() + 16, ivkey.begin() + 16 + key.size(), key.begin());
-    std::copy(ivkey.begin(), ivkey.begin() + iv.size(), iv.begin());
-
-    CryptoPP::AES::Decryption aesDecryption(key.data(), CryptoPP::AES::DEFAULT_KEYLENGTH);
-    CryptoPP::CBC_Mode_ExternalCipher::Decryption cbcDecryption(aesDecryption, iv.data());
-
-    for (size_t i = 0; i < decrypted.size(); i += CryptoPP::AES::BLOCKSIZE) {
-        cbcDecryption.ProcessData(decrypted.data() + i, ciphertext.data() + i,
-                                  CryptoPP::AES::BLOCKSIZE);
-    }
+    AesCbcDecrypt(ivkey, ciphertext, decrypted);
 }
 
 void Crypto::decryptEFSM(std::span<CryptoPP::byte, 16> trophyKey,
@@ -167,49 +169,70 @@ void Crypto::PfsGenCryptoKey(std::span<const CryptoPP::byte, 32> ekpfs,
                              std::span<CryptoPP::byte, 16> tweakKey) {
     CryptoPP::HMAC<CryptoPP::SHA256> hmac(ekpfs.data(), ekpfs.size());
 
-    CryptoPP::SecByteBlock d(20); // Use Crypto++ SecByteBlock for better memory management
+    std::array<CryptoPP::byte, 20> d;
 
     // Copy the bytes of 'index' to the 'd' array
     uint32_t index = 1;
-    std::memcpy(d, &index, sizeof(uint32_t));
+    std::memcpy(d.data(), &index, sizeof(uint32_t));
 
     // Copy the bytes of 'seed' to the 'd' array starting from index 4
-    std::memcpy(d + sizeof(uint32_t), seed.data(), seed.size());
+    std::memcpy(d.data() + sizeof(uint32_t), seed.data(), seed.size());
 
-    // Allocate memory for 'u64' using new
-    std::vector<CryptoPP::byte> data_tweak_key(hmac.DigestSize());
+    std::array<CryptoPP::byte, CryptoPP::SHA256::DIGESTSIZE> data_tweak_key;
 
     // Calculate the HMAC
-    hmac.CalculateDigest(data_tweak_key.data(), d, d.size());
+    hmac.CalculateDigest(data_tweak_key.data(), d.data(), d.size());
     std::copy(data_tweak_key.begin(), data_tweak_key.begin() + dataKey.size(), tweakKey.begin());
     std::copy(data_tweak_key.begin() + tweakKey.size(),
               data_tweak_key.begin() + tweakKey.size() + dataKey.size(), dataKey.begin());
 }
 
-void Crypto::decryptPFS(std::span<const CryptoPP::byte, 16> dataKey,
-                        std::span<const CryptoPP::byte, 16> tweakKey, std::span<const u8> src_image,
-                        std::span<CryptoPP::byte> dst_image, u64 sector) {
+void Crypto::decryptPFS(const Common::AesXts::PfsCipherSession& session,
+                        std::span<const u8> src_image, std::span<CryptoPP::byte> dst_image,
+                        u64 sector) const {
     // Start at 0x10000 to keep the header when decrypting the whole pfs_image.
-    for (int i = 0; i < src_image.size(); i += 0x1000) {
-        const u64 current_sector = sector + (i / 0x1000);
-        CryptoPP::ECB_Mode<CryptoPP::AES>::Encryption encrypt(tweakKey.data(), tweakKey.size());
-        CryptoPP::ECB_Mode<CryptoPP::AES>::Decryption decrypt(dataKey.data(), dataKey.size());
-
-        std::array<CryptoPP::byte, 16> tweak{};
-        std::array<CryptoPP::byte, 16> encryptedTweak;
-        std::array<CryptoPP::byte, 16> xorBuffer;
-        std::memcpy(tweak.data(), &current_sector, sizeof(u64));
-
-        // Encrypt the tweak for each sector.
-        encrypt.ProcessData(encryptedTweak.data(), tweak.data(), 16);
-
-        for (int plaintextOffset = 0; plaintextOffset < 0x1000; plaintextOffset += 16) {
-            xtsXorBlock(xorBuffer.data(), src_image.data() + i + plaintextOffset,
-                        encryptedTweak.data());                          // x, c, t
-            decrypt.ProcessData(xorBuffer.data(), xorBuffer.data(), 16); // x, x
-            xtsXorBlock(dst_image.data() + i + plaintextOffset, xorBuffer.data(),
-                        encryptedTweak.data()); //(p)  c, x , t
-            xtsMult(encryptedTweak);
-        }
+    session.DecryptSectors(src_image, dst_image, sector);
+}
+
+void Crypto::decryptPFSParallel(const Common::AesXts::PfsCipherSession& session,
+                                std::span<const u8> src_image,
+                                std::span<CryptoPP::byte> dst_image, u64 sector) const {
+    // Each sector's tweak only depends on its index, so any split into whole sectors works.
+    // Chunks are kept to at least 1 MiB so small regions do not pay for thread startup.
+    constexpr u64 MinChunkSectors = 0x100;
+    const u64 num_sectors = std::min(src_image.size(), dst_image.size()) / 0x1000;
+    const u64 max_chunks = std::max(1u, std::thread::hardware_concurrency());
+    const u64 num_chunks = std::clamp<u64>(num_sectors / MinChunkSectors, 1, max_chunks);
+    const u64 chunk_sectors = (num_sectors + num_chunks - 1) / num_chunks;
+    if (num_chunks == 1) {
+        decryptPFS(session, src_image, dst_image, sector);
+        return;
+    }
+
+    const auto decrypt_chunk = [&](u64 first) {
+        const u64 count = std::min(chunk_sectors, num_sectors - first);
+        decryptPFS(session, src_image.subspan(first * 0x1000, count * 0x1000),
+                   dst_image.subspan(first * 0x1000, count * 0x1000), sector + first);
+    };
+    std::vector<std::jthread> workers;
+    for (u64 first = chunk_sectors; first < num_sectors; first += chunk_sectors) {
+        workers.emplace_back(decrypt_chunk, first);
+    }
+    decrypt_chunk(0);
+}
+
+void Crypto::decryptPFSRange(const Common::AesXts::PfsCipherSession& session,
+                             std::span<const u8> src_image, std::span<CryptoPP::byte> dst_image,
+                             u64 sector, u64 offset, u64 length) const {
+    const u64 first = offset / 0x1000;
+    u64 last = (offset + length + 0xFFF) / 0x1000;
+    const u64 available = std::min(src_image.size(), dst_image.size()) / 0x1000;
+    if (last > available) {
+        last = available;
+    }
+    if (first >= last) {
+        return;
     }
+    decryptPFS(session, src_image.subspan(first * 0x1000, (last - first) * 0x1000),
+               dst_image.subspan(first * 0x1000), sector + first);
 }
@@ -12,25 +12,26 @@
 #include <cryptopp/rsa.h>
 #include <cryptopp/sha.h>
 
+#include "aes_xts.h"
 #include "keys.h"
 #include "types.h"
 
 class Crypto {
 public:
-    CryptoPP::RSA::PrivateKey key_pkg_derived_key3_keyset_init();
-    CryptoPP::RSA::PrivateKey FakeKeyset_keyset_init();
-    CryptoPP::RSA::PrivateKey DebugRifKeyset_init();
+    static CryptoPP::RSA::PrivateKey key_pkg_derived_key3_keyset_init();
+    static CryptoPP::RSA::PrivateKey FakeKeyset_keyset_init();
+    static CryptoPP::RSA::PrivateKey DebugRifKeyset_init();
 
     void RSA2048Decrypt(std::span<CryptoPP::byte, 32> dk3,
                         std::span<const CryptoPP::byte, 256> ciphertext,
-                        bool is_dk3); // RSAES_PKCS1v15_
+                        bool is_dk3); // RSAES_PKCS1v15_, keysets are parsed once per process
     void ivKeyHASH256(std::span<const CryptoPP::byte, 64> cipher_input,
                       std::span<CryptoPP::byte, 32> ivkey_result);
     void aesCbcCfb128Decrypt(std::span<const CryptoPP::byte, 32> ivkey,
                              std::span<const CryptoPP::byte, 256> ciphertext,
                              std::span<CryptoPP::byte, 256> decrypted);
     void aesCbcCfb128DecryptEntry(std::span<const CryptoPP::byte, 32> ivkey,
-                                  std::span<CryptoPP::byte> ciphertext,
+                                  std::span<const CryptoPP::byte> ciphertext,
                                   std::span<CryptoPP::byte> decrypted);
     void decryptEFSM(std::span<CryptoPP::byte, 16> trophyKey,
                      std::span<CryptoPP::byte, 16> NPcommID, std::span<CryptoPP::byte, 16> efsmIv,
@@ -39,25 +40,16 @@ public:
                          std::span<const CryptoPP::byte, 16> seed,
                          std::span<CryptoPP::byte, 16> dataKey,
                          std::span<CryptoPP::byte, 16> tweakKey);
-    void decryptPFS(std::span<const CryptoPP::byte, 16> dataKey,
-                    std::span<const CryptoPP::byte, 16> tweakKey, std::span<const u8> src_image,
-                    std::span<CryptoPP::byte> dst_image, u64 sector);
-
-    void xtsXorBlock(CryptoPP::byte* x, const CryptoPP::byte* a, const CryptoPP::byte* b) {
-        for (int i = 0; i < 16; i++) {
-            x[i] = a[i] ^ b[i];
-        }
-    }
-
-    void xtsMult(std::span<CryptoPP::byte, 16> encryptedTweak) {
-        int feedback = 0;
-        for (int k = 0; k < encryptedTweak.size(); k++) {
-            const auto tmp = (encryptedTweak[k] >> 7) & 1;
-            encryptedTweak[k] = ((encryptedTweak[k] << 1) + feedback) & 0xFF;
-            feedback = tmp;
-        }
-        if (feedback != 0) {
-            encryptedTweak[0] ^= 0x87;
-        }
-    }
+    void decryptPFS(const Common::AesXts::PfsCipherSession& session,
+                    std::span<const u8> src_image, std::span<CryptoPP::byte> dst_image,
+                    u64 sector) const;
+    // Splits the sectors across all hardware threads, for large regions decrypted up front.
+    void decryptPFSParallel(const Common::AesXts::PfsCipherSession& session,
+                            std::span<const u8> src_image, std::span<CryptoPP::byte> dst_image,
+                            u64 sector) const;
+    // Decrypts only the sectors overlapping [offset, offset + length). Both images start at
+    // the given sector and offset is relative to that; incomplete trailing sectors are skipped.
+    void decryptPFSRange(const Common::AesXts::PfsCipherSession& session,
+                         std::span<const u8> src_image, std::span<CryptoPP::byte> dst_image,
+                         u64 sector, u64 offset, u64 length) const;
 };
@@ -0,0 +1,522 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+#include <fmt/format.h>
+
+#include "extractor.h"
+#include "io_file.h"
+
+u32 ExtractorConfig::DefaultWorkerThreads() {
+    return std::max(1u, std::thread::hardware_concurrency() / 2);
+}
+
+// Enough buffers for every queue to be full with one job in each worker on top.
+static std::size_t BufferPoolSize(const ExtractorConfig& config) {
+    const u32 workers = config.reader_threads + config.decrypt_threads + config.inflate_threads +
+                        config.writer_threads;
+    return static_cast<std::size_t>(config.queue_depth) * (2 + config.writer_threads) + workers;
+}
+
+Extractor::Extractor(PKG& pkg_, const ExtractorConfig& config_)
+    : pkg{pkg_}, plan{pkg_.GetExtractionPlan()}, config{config_},
+      data_pool{BufferPoolSize(config_)}, output_pool{BufferPoolSize(config_)},
+      decrypt_queue{config_.queue_depth}, inflate_queue{config_.queue_depth} {
+    config.reader_threads = std::max(1u, config.reader_threads);
+    config.decrypt_threads = std::max(1u, config.decrypt_threads);
+    config.inflate_threads = std::max(1u, config.inflate_threads);
+    config.writer_threads = std::max(1u, config.writer_threads);
+
+    for (u32 i = 0; i < config.writer_threads; i++) {
+        writer_queues.push_back(
+            std::make_unique<Common::BoundedQueue<PFSBlockJob>>(config.queue_depth));
+    }
+    total_blocks = plan.GetTotalBlocks();
+
+    // Number the jobs in PKG order, the digests are fed in that order.
+    std::vector<u32> pkg_order(plan.runs.size());
+    std::iota(pkg_order.begin(), pkg_order.end(), 0u);
+    std::sort(pkg_order.begin(), pkg_order.end(), [this](u32 a, u32 b) {
+        return pkg.GetBlockRunExtent(plan.runs[a]).first <
+               pkg.GetBlockRunExtent(plan.runs[b]).first;
+    });
+    run_sequences.resize(plan.runs.size());
+    u64 sequence = 0;
+    for (const u32 index : pkg_order) {
+        run_sequences[index] = sequence;
+        sequence += (plan.runs[index].num_blocks + MaxBlocksPerJob - 1) / MaxBlocksPerJob;
+    }
+
+    // The plan lists runs largest first, dealing them out in turn keeps every reader's share
+    // in that order. Hashing goes front to back, so the readers have to as well.
+    for (u32 i = 0; i < config.reader_threads; i++) {
+        run_deques.push_back(std::make_unique<RunDeque>());
+    }
+    for (u32 i = 0; i < plan.runs.size(); i++) {
+        const u32 index = config.verify_digests ? pkg_order[i] : i;
+        run_deques[i % run_deques.size()]->runs.push_back(index);
+    }
+}
+
+Extractor::~Extractor() = default;
+
+bool Extractor::Run(const std::function<bool(u64)>& progress) {
+    // Empty files never reach the writers, create them here.
+    for (u32 slot = 0; slot < plan.GetNumberOfFiles(); slot++) {
+        if (plan.block_counts[slot] == 0) {
+            Common::FS::IOFile out(plan.GetPath(slot), Common::FS::FileAccessMode::Write);
+        }
+    }
+
+    // One mapping serves every reader. Without it reads are positional on a shared handle.
+    if (!pkg_file.Open(pkg.GetPkgPath())) {
+        Fail(fmt::format("Failed to open {}", pkg.GetPkgPath().string()));
+        return false;
+    }
+    pkg_file.Advise(0, pkg_file.GetSize(), Common::FS::AccessHint::Sequential);
+    if (config.verify_digests) {
+        digests = std::make_unique<PKGDigestStream>(pkg.GetPkgHeader(), pkg_file);
+    }
+
+    readers_left = config.reader_threads;
+    decrypters_left = config.decrypt_threads;
+    inflaters_left = config.inflate_threads;
+    writers_left = config.writer_threads;
+
+    std::vector<std::jthread> threads;
+    for (u32 i = 0; i < config.reader_threads; i++) {
+        threads.emplace_back(&Extractor::ReaderThread, this, i);
+    }
+    for (u32 i = 0; i < config.decrypt_threads; i++) {
+        threads.emplace_back(&Extractor::DecryptThread, this);
+    }
+    for (u32 i = 0; i < config.inflate_threads; i++) {
+        threads.emplace_back(&Extractor::InflateThread, this);
+    }
+    for (u32 i = 0; i < config.writer_threads; i++) {
+        threads.emplace_back(&Extractor::WriterThread, this, i);
+    }
+
+    std::unique_lock lock{finished_mutex};
+    while (!finished_cv.wait_for(lock, std::chrono::milliseconds(100),
+                                 [this] { return writers_left == 0; })) {
+        if (!progress(blocks_written) && !cancelled) {
+            Cancel();
+        }
+    }
+    lock.unlock();
+    threads.clear();
+    if (digests) {
+        // Only what lies past the last block is left to hash.
+        digest_report = digests->Finish(&cancelled);
+        digests.reset();
+    }
+    pkg_file.Close();
+
+    progress(blocks_written);
+    return !cancelled;
+}
+
+void Extractor::Cancel() {
+    cancelled = true;
+    if (digests) {
+        digests->Cancel();
+    }
+    decrypt_queue.Close();
+    inflate_queue.Close();
+    for (auto& queue : writer_queues) {
+        queue->Close();
+    }
+}
+
+void Extractor::Fail(std::string message) {
+    {
+        std::scoped_lock lock{error_mutex};
+        if (!error.empty()) {
+            return;
+        }
+        error = std::move(message);
+    }
+    Cancel();
+}
+
+void Extractor::FailRead(const PFSBlockJob& job) {
+    const auto name = plan.tree.GetName(plan.inodes[job.slot]);
+    Fail(fmt::format("Failed to read {}: the PKG ends before block {}", name, job.first_block));
+}
+
+void Extractor::FailWrite(u32 slot) {
+    Fail(fmt::format("Failed to write {}", plan.tree.GetName(plan.inodes[slot])));
+}
+
+std::optional<u32> Extractor::NextRun(u32 reader) {
+    {
+        RunDeque& own = *run_deques[reader];
+        std::scoped_lock lock{own.mutex};
+        if (!own.runs.empty()) {
+            const u32 index = own.runs.front();
+            own.runs.pop_front();
+            return index;
+        }
+    }
+
+    // Take the smallest run left with another reader, it keeps its larger ones in order.
+    for (u32 i = 1; i < run_deques.size(); i++) {
+        RunDeque& victim = *run_deques[(reader + i) % run_deques.size()];
+        std::scoped_lock lock{victim.mutex};
+        if (!victim.runs.empty()) {
+            const u32 index = victim.runs.back();
+            victim.runs.pop_back();
+            return index;
+        }
+    }
+    return std::nullopt;
+}
+
+void Extractor::ReaderThread(u32 index) {
+    if (config.use_async_io) {
+        ReadAsync(index);
+    } else {
+        while (!cancelled) {
+            const auto next = NextRun(index);
+            if (!next) {
+                break;
+            }
+            const PFSBlockRun& run = plan.runs[*next];
+            const auto [offset, length] = pkg.GetBlockRunExtent(run);
+            pkg_file.Advise(offset, length, Common::FS::AccessHint::WillNeed);
+            const u32 end = run.first_block + run.num_blocks;
+            u64 sequence = run_sequences[*next];
+            for (u32 block = run.first_block; block < end; block += MaxBlocksPerJob) {
+                PFSBlockJob job{};
+                job.slot = run.slot;
+                job.first_block = block;
+                job.num_blocks = std::min(MaxBlocksPerJob, end - block);
+                job.sequence = sequence++;
+                if (!pkg_file.IsMapped()) {
+                    job.data = data_pool.Acquire();
+                }
+                if (!pkg.ReadBlock(pkg_file, job)) {
+                    FailRead(job);
+                    break;
+                }
+                if (!FeedDigests(job) || !decrypt_queue.Push(std::move(job))) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (--readers_left == 0) {
+        decrypt_queue.Close();
+    }
+}
+
+void Extractor::ReadAsync(u32 index) {
+    enum class SlotState { Free, Reading, Read };
+
+    Common::FS::AsyncIO io(config.io_queue_depth);
+    // Every request in the ring has a slot and is tagged with it. A slot gets the next job as
+    // soon as its read is passed on, so the ring stays full rather than draining between batches.
+    std::vector<PFSBlockJob> slots(io.GetQueueDepth());
+    std::vector<SlotState> states(slots.size(), SlotState::Free);
+    const PFSBlockRun* run = nullptr;
+    u32 block = 0;
+    u64 sequence = 0;
+    bool runs_left = true;
+
+    const auto queue_next = [&](u32 slot) {
+        while (runs_left && (!run || block == run->first_block + run->num_blocks)) {
+            const auto next = NextRun(index);
+            if (!next) {
+                runs_left = false;
+                break;
+            }
+            run = &plan.runs[*next];
+            block = run->first_block;
+            sequence = run_sequences[*next];
+            const auto [offset, length] = pkg.GetBlockRunExtent(*run);
+            pkg_file.Advise(offset, length, Common::FS::AccessHint::WillNeed);
+        }
+        if (!runs_left) {
+            return;
+        }
+        PFSBlockJob& job = slots[slot];
+        job = {};
+        job.slot = run->slot;
+        job.first_block = block;
+        job.num_blocks = std::min(MaxBlocksPerJob, run->first_block + run->num_blocks - block);
+        job.sequence = sequence++;
+        pkg.PrepareBlock(job);
+        job.data = data_pool.Acquire(job.read_size);
+        block += job.num_blocks;
+        states[slot] = SlotState::Reading;
+        io.QueueRead(pkg_file.GetFile(), job.pkg_offset, job.data, slot);
+    };
+
+    // Any read job can go on, unless the digests are verified. Then it has to be the first of
+    // the outstanding jobs, the digests take them in PKG order.
+    const auto next_read = [&]() -> std::optional<u32> {
+        std::optional<u32> next;
+        for (u32 slot = 0; slot < slots.size(); slot++) {
+            if (states[slot] == SlotState::Free) {
+                continue;
+            }
+            if (!digests && states[slot] == SlotState::Read) {
+                return slot;
+            }
+            if (!next || slots[slot].sequence < slots[*next].sequence) {
+                next = slot;
+            }
+        }
+        if (next && states[*next] == SlotState::Read) {
+            return next;
+        }
+        return std::nullopt;
+    };
+
+    for (u32 slot = 0; slot < slots.size(); slot++) {
+        queue_next(slot);
+    }
+    while (!cancelled) {
+        // Refilling happens out here, the synchronous fallback completes reads on queueing.
+        while (const auto slot = next_read()) {
+            PFSBlockJob& job = slots[*slot];
+            if (!FeedDigests(job) || !decrypt_queue.Push(std::move(job))) {
+                break;
+            }
+            states[*slot] = SlotState::Free;
+            queue_next(*slot);
+        }
+        if (cancelled || !io.HasPending()) {
+            break;
+        }
+        io.Submit();
+        io.Reap(true, [&](u64 tag, s64 result) {
+            PFSBlockJob& job = slots[tag];
+            if (result != static_cast<s64>(job.read_size)) {
+                FailRead(job);
+                return;
+            }
+            job.source = std::span<const u8>(job.data).first(job.read_size);
+            states[tag] = SlotState::Read;
+        });
+    }
+
+    // The kernel may still be reading into the slots.
+    while (io.HasPending()) {
+        io.Reap(true, [](u64, s64) {});
+    }
+}
+
+bool Extractor::FeedDigests(const PFSBlockJob& job) {
+    return !digests || digests->Feed(job.sequence, job.pkg_offset, job.source);
+}
+
+void Extractor::DecryptThread() {
+    while (auto job = decrypt_queue.Pop()) {
+        if (cancelled) {
+            break;
+        }
+        // DecryptBlock sizes data itself and leaves it alone if every block goes straight to
+        // the output.
+        if (job->data.empty()) {
+            job->data = data_pool.Acquire();
+        }
+        job->output = output_pool.Acquire(static_cast<std::size_t>(job->num_blocks) * 0x10000);
+        pkg.DecryptBlock(*job);
+        if (config.cache_eviction != CacheEviction::None) {
+            pkg_file.Advise(job->pkg_offset + job->data_offset, job->data_size,
+                            Common::FS::AccessHint::DontNeed);
+        }
+        if (!inflate_queue.Push(std::move(*job))) {
+            break;
+        }
+    }
+
+    if (--decrypters_left == 0) {
+        inflate_queue.Close();
+    }
+}
+
+void Extractor::InflateThread() {
+    PfscInflater inflater(config.inflate_backend);
+    while (auto job = inflate_queue.Pop()) {
+        if (cancelled) {
+            break;
+        }
+        const auto result = pkg.InflateBlock(*job, inflater);
+        if (result != PfscInflateError::None) {
+            const auto name = plan.tree.GetName(plan.inodes[job->slot]);
+            Fail(fmt::format("Failed to extract {}: {}", name, GetPfscInflateErrorString(result)));
+            break;
+        }
+        // Only the output is needed from here on, hand the sector buffer back.
+        data_pool.Release(std::move(job->data));
+        // Every file belongs to one writer, so writers never share an output handle.
+        auto& queue = writer_queues[job->slot % writer_queues.size()];
+        if (!queue->Push(std::move(*job))) {
+            break;
+        }
+    }
+
+    if (--inflaters_left == 0) {
+        for (auto& queue : writer_queues) {
+            queue->Close();
+        }
+    }
+}
+
+void Extractor::WriterThread(u32 index) {
+    if (config.use_async_io) {
+        WriteAsync(*writer_queues[index]);
+    } else {
+        std::unordered_map<u32, OutputFile> open_files;
+        while (auto job = writer_queues[index]->Pop()) {
+            if (cancelled) {
+                break;
+            }
+            const u32 slot = job->slot;
+            const u32 num_blocks = job->num_blocks;
+            OutputFile& out = GetOutputFile(open_files, slot);
+            const u64 offset = static_cast<u64>(job->first_block) * 0x10000;
+            if (!out.pending.empty() && offset != out.pending_offset + out.pending_size) {
+                WritePending(out);
+            }
+            if (out.pending.empty()) {
+                out.pending_offset = offset;
+            }
+
+            out.pending_size += job->write_size;
+            out.pending.push_back(std::move(*job));
+            if (out.pending_size >= config.write_combine_size) {
+                WritePending(out);
+            }
+            FinishBlocks(open_files, slot, num_blocks);
+        }
+    }
+
+    if (--writers_left == 0) {
+        std::scoped_lock lock{finished_mutex};
+        finished_cv.notify_all();
+    }
+}
+
+void Extractor::WriteAsync(Common::BoundedQueue<PFSBlockJob>& queue) {
+    Common::FS::AsyncIO io(config.io_queue_depth);
+    std::unordered_map<u32, OutputFile> open_files;
+    std::vector<PFSBlockJob> batch;
+
+    while (auto job = queue.Pop()) {
+        // Gather whatever else is ready so a single submit covers many blocks.
+        batch.push_back(std::move(*job));
+        while (batch.size() < io.GetQueueDepth()) {
+            auto next = queue.TryPop();
+            if (!next) {
+                break;
+            }
+            batch.push_back(std::move(*next));
+        }
+        if (cancelled) {
+            break;
+        }
+
+        for (u32 i = 0; i < batch.size(); i++) {
+            const PFSBlockJob& block = batch[i];
+            const std::span<const u8> data(reinterpret_cast<const u8*>(block.output.data()),
+                                           block.write_size);
+            io.QueueWrite(GetOutputFile(open_files, block.slot).file,
+                          static_cast<u64>(block.first_block) * 0x10000, data, i);
+        }
+        io.Submit();
+        const PFSBlockJob* short_write = nullptr;
+        while (io.HasPending()) {
+            io.Reap(true, [&](u64 tag, s64 result) {
+                if (result != static_cast<s64>(batch[tag].write_size)) {
+                    short_write = &batch[tag];
+                }
+            });
+        }
+        if (short_write) {
+            FailWrite(short_write->slot);
+            break;
+        }
+
+        for (auto& block : batch) {
+            AddUncommitted(open_files.at(block.slot), block.write_size);
+            blocks_written += block.num_blocks;
+            FinishBlocks(open_files, block.slot, block.num_blocks);
+            output_pool.Release(std::move(block.output));
+        }
+        batch.clear();
+    }
+}
+
+Extractor::OutputFile& Extractor::GetOutputFile(std::unordered_map<u32, OutputFile>& open_files,
+                                                u32 slot) {
+    auto [it, inserted] = open_files.try_emplace(slot);
+    if (inserted) {
+        it->second.file.Open(plan.GetPath(slot), Common::FS::FileAccessMode::Write);
+        it->second.blocks_left = plan.block_counts[slot];
+        // Reserve the final size before the first block lands, so the file is laid out in
+        // few extents and blocks can be written at their offsets in any order.
+        it->second.file.Allocate(plan.sizes[slot]);
+    }
+    return it->second;
+}
+
+void Extractor::WritePending(OutputFile& out) {
+    if (out.pending.empty()) {
+        return;
+    }
+
+    std::vector<std::span<const u8>> buffers;
+    buffers.reserve(out.pending.size());
+    for (const auto& job : out.pending) {
+        buffers.emplace_back(reinterpret_cast<const u8*>(job.output.data()), job.write_size);
+    }
+    if (out.file.WriteVectorAt(out.pending_offset, buffers) != out.pending_size) {
+        FailWrite(out.pending.front().slot);
+        return;
+    }
+
+    AddUncommitted(out, out.pending_size);
+
+    for (auto& job : out.pending) {
+        blocks_written += job.num_blocks;
+        output_pool.Release(std::move(job.output));
+    }
+    out.pending.clear();
+    out.pending_size = 0;
+}
+
+void Extractor::AddUncommitted(OutputFile& out, u64 size) {
+    out.uncommitted_size += size;
+    if (config.commit_interval != 0 && out.uncommitted_size >= config.commit_interval) {
+        out.file.Commit();
+        out.uncommitted_size = 0;
+    }
+}
+
+void Extractor::FinishBlocks(std::unordered_map<u32, OutputFile>& open_files, u32 slot,
+                             u32 num_blocks) {
+    auto it = open_files.find(slot);
+    OutputFile& out = it->second;
+    out.blocks_left -= num_blocks;
+    if (out.blocks_left == 0) {
+        WritePending(out);
+        if (config.commit_interval != 0 && out.uncommitted_size != 0) {
+            out.file.Commit();
+        }
+        if (config.cache_eviction == CacheEviction::InputAndOutput) {
+            // Dirty pages are not dropped, they have to reach the disk first.
+            out.file.WriteBack(0, plan.sizes[slot]);
+            out.file.Advise(0, plan.sizes[slot], Common::FS::AccessHint::DontNeed);
+        }
+        open_files.erase(it);
+    }
+}
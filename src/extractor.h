@@ -0,0 +1,160 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "async_io.h"
+#include "bounded_queue.h"
+#include "buffer_pool.h"
+#include "mapped_file.h"
+#include "pkg.h"
+#include "pkg_digest.h"
+#include "types.h"
+
+// Which extracted data should be dropped from the page cache once it has been used.
+enum class CacheEviction {
+    None,           // Leave the page cache alone.
+    Input,          // Drop PKG pages once their blocks have been decrypted.
+    InputAndOutput, // Also write out every output file once it is complete and drop its pages.
+};
+
+// Number of threads per pipeline stage. Slow disks want few readers and writers, fast NVMe
+// drives can keep more requests in flight.
+struct ExtractorConfig {
+    u32 reader_threads = 2;
+    u32 decrypt_threads = DefaultWorkerThreads();
+    u32 inflate_threads = DefaultWorkerThreads();
+    u32 writer_threads = 2;
+    u32 queue_depth = 32; // Jobs buffered between two stages.
+
+    // Batch reads and writes through io_uring where available, falls back to positional
+    // synchronous I/O otherwise.
+    bool use_async_io = false;
+    u32 io_queue_depth = 32; // Requests in flight per reader or writer thread.
+
+    // Consecutive blocks of a file are combined into one write of at least this many bytes.
+    u64 write_combine_size = 8_MB;
+    // Bytes written to a file between fsyncs. 0 leaves write-back entirely to the OS.
+    u64 commit_interval = 0;
+
+    // A PKG is read exactly once, by default its pages do not get to push out everything else.
+    CacheEviction cache_eviction = CacheEviction::Input;
+
+    // Decoder used for compressed blocks. zlib-ng remains available as a fallback.
+    PfscInflateBackend inflate_backend = PfscInflateBackend::BuiltIn;
+
+    // Check the digests of the PKG header while extracting. The readers hash the sectors they
+    // read, so runs are handed out in PKG order rather than largest first.
+    bool verify_digests = false;
+
+    static u32 DefaultWorkerThreads();
+};
+
+// Extracts the files of an opened PKG with separate reader, decrypt, inflate and writer
+// stages connected by bounded queues, so disk reads overlap with CPU work and output writes.
+class Extractor {
+public:
+    explicit Extractor(PKG& pkg, const ExtractorConfig& config = {});
+    ~Extractor();
+
+    u64 GetTotalBlocks() const {
+        return total_blocks;
+    }
+
+    // Runs the pipeline until every block is written. The callback is invoked periodically on
+    // the calling thread with the number of blocks written so far and returns false to cancel.
+    // Returns false if the extraction was cancelled or failed.
+    bool Run(const std::function<bool(u64)>& progress);
+
+    // Filled in by Run when verify_digests is set.
+    const DigestReport& GetDigestReport() const {
+        return digest_report;
+    }
+
+    // Describes the first block that could not be extracted, empty if there was none.
+    std::string GetError() const {
+        std::scoped_lock lock{error_mutex};
+        return error;
+    }
+
+private:
+    // Consecutive blocks read and decrypted as one job, at most 512 KiB of output.
+    static constexpr u32 MaxBlocksPerJob = 8;
+
+    // Runs handed to one reader, largest first. The owner takes from the front and readers
+    // that ran out of work steal from the back.
+    struct RunDeque {
+        std::mutex mutex;
+        std::deque<u32> runs;
+    };
+
+    struct OutputFile {
+        Common::FS::IOFile file;
+        u32 blocks_left;
+
+        // Consecutive blocks waiting to be written with a single vectored write.
+        std::vector<PFSBlockJob> pending;
+        u64 pending_offset = 0;
+        u64 pending_size = 0;
+        u64 uncommitted_size = 0;
+    };
+
+    std::optional<u32> NextRun(u32 reader);
+    void ReaderThread(u32 index);
+    void ReadAsync(u32 index);
+    bool FeedDigests(const PFSBlockJob& job);
+    void DecryptThread();
+    void InflateThread();
+    void WriterThread(u32 index);
+    void WriteAsync(Common::BoundedQueue<PFSBlockJob>& queue);
+    OutputFile& GetOutputFile(std::unordered_map<u32, OutputFile>& open_files, u32 slot);
+    void WritePending(OutputFile& out);
+    void AddUncommitted(OutputFile& out, u64 size);
+    void FinishBlocks(std::unordered_map<u32, OutputFile>& open_files, u32 slot,
+                      u32 num_blocks);
+    void Cancel();
+    void Fail(std::string message);
+    void FailRead(const PFSBlockJob& job);
+    void FailWrite(u32 slot);
+
+    PKG& pkg;
+    const ExtractionPlan& plan;
+    ExtractorConfig config;
+    u64 total_blocks = 0;
+    Common::FS::MappedFile pkg_file;
+
+    std::vector<std::unique_ptr<RunDeque>> run_deques;
+    std::vector<u64> run_sequences; // Sequence number of the first job of every run.
+    std::atomic<u64> blocks_written{0};
+    std::atomic<bool> cancelled{false};
+    std::atomic<u32> readers_left{0};
+    std::atomic<u32> decrypters_left{0};
+    std::atomic<u32> inflaters_left{0};
+    std::atomic<u32> writers_left{0};
+    std::mutex finished_mutex;
+    std::condition_variable finished_cv;
+    mutable std::mutex error_mutex;
+    std::string error;
+    std::unique_ptr<PKGDigestStream> digests; // Only while Run verifies the digests.
+    DigestReport digest_report;
+
+    // Sector and output buffers travel with the jobs and come back here once they are done
+    // with, so the pipeline stops allocating after the first few jobs.
+    Common::BufferPool<u8> data_pool;
+    Common::BufferPool<char> output_pool;
+
+    Common::BoundedQueue<PFSBlockJob> decrypt_queue;
+    Common::BoundedQueue<PFSBlockJob> inflate_queue;
+    std::vector<std::unique_ptr<Common::BoundedQueue<PFSBlockJob>>> writer_queues;
+};
@@ -18,6 +18,9 @@
 #include <share.h>
 #include <windows.h>
 #else
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
@@ -289,6 +292,142 @@ std::string IOFile::ReadString(size_t length) const {
     return std::string{string_buffer.data(), string_size};
 }
 
+size_t IOFile::ReadAtRaw(u64 offset, void* data, size_t size) const {
+    if (!IsOpen()) {
+        return 0;
+    }
+
+    auto* out = static_cast<u8*>(data);
+    size_t total = 0;
+
+#ifdef _WIN32
+    HANDLE hfile = reinterpret_cast<HANDLE>(_get_osfhandle(fileno(file)));
+    while (total < size) {
+        const u64 position = offset + total;
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(position);
+        overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+
+        const DWORD chunk =
+            size - total > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size - total);
+        DWORD bytes_read = 0;
+        if (!ReadFile(hfile, out + total, chunk, &bytes_read, &overlapped) || bytes_read == 0) {
+            break;
+        }
+        total += bytes_read;
+    }
+#else
+    const int fd = fileno(file);
+    while (total < size) {
+        const auto bytes_read = pread(fd, out + total, size - total, offset + total);
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            // End of file or an error, the caller sees a short count either way.
+            break;
+        }
+        total += bytes_read;
+    }
+#endif
+
+    return total;
+}
+
+size_t IOFile::WriteAtRaw(u64 offset, const void* data, size_t size) const {
+    if (!IsOpen()) {
+        return 0;
+    }
+
+    const auto* in = static_cast<const u8*>(data);
+    size_t total = 0;
+
+#ifdef _WIN32
+    HANDLE hfile = reinterpret_cast<HANDLE>(_get_osfhandle(fileno(file)));
+    while (total < size) {
+        const u64 position = offset + total;
+        OVERLAPPED overlapped{};
+        overlapped.Offset = static_cast<DWORD>(position);
+        overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+
+        const DWORD chunk =
+            size - total > 0x40000000 ? 0x40000000 : static_cast<DWORD>(size - total);
+        DWORD bytes_written = 0;
+        if (!WriteFile(hfile, in + total, chunk, &bytes_written, &overlapped) ||
+            bytes_written == 0) {
+            break;
+        }
+        total += bytes_written;
+    }
+#else
+    const int fd = fileno(file);
+    while (total < size) {
+        const auto bytes_written = pwrite(fd, in + total, size - total, offset + total);
+        if (bytes_written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_written <= 0) {
+            // The caller sees the failure as a short count.
+            break;
+        }
+        total += bytes_written;
+    }
+#endif
+
+    return total;
+}
+
+size_t IOFile::WriteVectorAt(u64 offset, std::span<const std::span<const u8>> buffers) const {
+    if (!IsOpen()) {
+        return 0;
+    }
+
+    size_t total = 0;
+
+#ifdef _WIN32
+    for (const auto& buffer : buffers) {
+        const size_t bytes_written = WriteAtRaw(offset + total, buffer.data(), buffer.size());
+        total += bytes_written;
+        if (bytes_written != buffer.size()) {
+            break;
+        }
+    }
+#else
+    const int fd = fileno(file);
+    std::vector<iovec> iov;
+    size_t index = 0;
+    size_t skip = 0; // Bytes of buffers[index] already written by a short pwritev.
+
+    while (index < buffers.size()) {
+        iov.clear();
+        for (size_t i = index; i < buffers.size() && iov.size() < IOV_MAX; i++) {
+            const size_t start = i == index ? skip : 0;
+            iov.push_back({const_cast<u8*>(buffers[i].data()) + start, buffers[i].size() - start});
+        }
+
+        const auto bytes_written = pwritev(fd, iov.data(), iov.size(), offset + total);
+        if (bytes_written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_written <= 0) {
+            // The caller sees the failure as a short count.
+            break;
+        }
+        total += bytes_written;
+
+        // Advance past everything that was written, resuming mid-buffer after a short write.
+        size_t consumed = bytes_written + skip;
+        while (index < buffers.size() && consumed >= buffers[index].size()) {
+            consumed -= buffers[index].size();
+            index++;
+        }
+        skip = consumed;
+    }
+#endif
+
+    return total;
+}
+
 bool IOFile::Flush() const {
     if (!IsOpen()) {
         return false;
@@ -333,6 +472,23 @@ bool IOFile::Commit() const {
     return commit_result;
 }
 
+bool IOFile::WriteBack(u64 offset, u64 length) const {
+    if (!IsOpen() || std::fflush(file) != 0) {
+        return false;
+    }
+
+#ifdef _WIN32
+    return _commit(fileno(file)) == 0;
+#elif defined(__linux__)
+    // Only the data of the range, waiting for any write-back already in flight as well.
+    return sync_file_range(fileno(file), static_cast<off_t>(offset), static_cast<off_t>(length),
+                           SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                               SYNC_FILE_RANGE_WAIT_AFTER) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
 bool IOFile::SetSize(u64 size) const {
     if (!IsOpen()) {
         return false;
@@ -355,6 +511,38 @@ bool IOFile::SetSize(u64 size) const {
     return set_size_result;
 }
 
+bool IOFile::Allocate(u64 size) const {
+    if (!IsOpen()) {
+        return false;
+    }
+
+    errno = 0;
+
+#ifdef _WIN32
+    // Reserve the clusters up front, the size itself is set below.
+    HANDLE hfile = reinterpret_cast<HANDLE>(_get_osfhandle(fileno(file)));
+    FILE_ALLOCATION_INFO allocation_info{};
+    allocation_info.AllocationSize.QuadPart = static_cast<s64>(size);
+    SetFileInformationByHandle(hfile, FileAllocationInfo, &allocation_info,
+                               sizeof(allocation_info));
+#elif defined(__linux__)
+    // fallocate reserves the extents and sets the size in one go. Filesystems without support
+    // (EOPNOTSUPP) fall back to a plain resize.
+    if (fallocate(fileno(file), 0, 0, static_cast<s64>(size)) == 0) {
+        return true;
+    }
+#elif defined(__APPLE__)
+    fstore_t store{F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(size),
+                   0};
+    if (fcntl(fileno(file), F_PREALLOCATE, &store) != 0) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fileno(file), F_PREALLOCATE, &store);
+    }
+#endif
+
+    return SetSize(size);
+}
+
 u64 IOFile::GetSize() const {
     if (!IsOpen()) {
         return 0;
@@ -376,6 +564,42 @@ u64 IOFile::GetSize() const {
     return file_size;
 }
 
+bool IOFile::Advise(u64 offset, u64 length, AccessHint hint) const {
+    if (!IsOpen()) {
+        return false;
+    }
+
+#if defined(__linux__)
+    int advice = POSIX_FADV_NORMAL;
+    switch (hint) {
+    case AccessHint::Normal:
+        advice = POSIX_FADV_NORMAL;
+        break;
+    case AccessHint::Sequential:
+        advice = POSIX_FADV_SEQUENTIAL;
+        break;
+    case AccessHint::WillNeed:
+        advice = POSIX_FADV_WILLNEED;
+        break;
+    case AccessHint::DontNeed:
+        // Also starts write-back of dirty pages, only clean pages are dropped.
+        advice = POSIX_FADV_DONTNEED;
+        break;
+    }
+    return posix_fadvise(fileno(file), static_cast<off_t>(offset), static_cast<off_t>(length),
+                         advice) == 0;
+#elif defined(__APPLE__)
+    if (hint == AccessHint::WillNeed) {
+        radvisory advisory{static_cast<off_t>(offset),
+                           static_cast<int>(length > INT_MAX ? INT_MAX : length)};
+        return fcntl(fileno(file), F_RDADVISE, &advisory) != -1;
+    }
+    return true;
+#else
+    return true;
+#endif
+}
+
 bool IOFile::Seek(s64 offset, SeekOrigin origin) const {
     if (!IsOpen()) {
         return false;
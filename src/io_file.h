@@ -63,6 +63,13 @@ enum class SeekOrigin : u32 {
     End,             // Seeks from the end of the file.
 };
 
+enum class AccessHint {
+    Normal,     // No particular access pattern.
+    Sequential, // The file is read front to back, read ahead aggressively.
+    WillNeed,   // The range is about to be read, start reading it in now.
+    DontNeed,   // The range will not be touched again, its cached pages can be dropped.
+};
+
 class IOFile final {
 public:
     IOFile();
@@ -113,10 +120,27 @@ public:
 
     bool Flush() const;
     bool Commit() const;
+    /**
+     * Writes the dirty pages of the given range out and waits until they are on the disk,
+     * leaving them clean so they can be dropped from the cache. Platforms without a ranged
+     * equivalent sync the whole file.
+     */
+    bool WriteBack(u64 offset, u64 length) const;
 
     bool SetSize(u64 size) const;
+    /**
+     * Sets the file size and asks the filesystem to reserve the space in as few extents as
+     * it can. Falls back to SetSize where preallocation is not supported.
+     */
+    bool Allocate(u64 size) const;
     u64 GetSize() const;
 
+    /**
+     * Tells the OS how the given range is going to be accessed. Purely a hint, platforms
+     * without an equivalent ignore it.
+     */
+    bool Advise(u64 offset, u64 length, AccessHint hint) const;
+
     bool Seek(s64 offset, SeekOrigin origin = SeekOrigin::SetOrigin) const;
     s64 Tell() const;
 
@@ -161,6 +185,46 @@ public:
         return std::fread(data, sizeof(T), size, file);
     }
 
+    /**
+     * Reads data.size() elements starting at the given file offset without touching the file
+     * position, so a single handle can be shared by several reader threads.
+     */
+    template <typename T>
+    size_t ReadAt(u64 offset, std::span<T> data) const {
+        static_assert(std::is_trivially_copyable_v<T>, "Data type must be trivially copyable.");
+
+        if (!IsOpen()) {
+            return 0;
+        }
+
+        return ReadAtRaw(offset, data.data(), data.size_bytes()) / sizeof(T);
+    }
+
+    size_t ReadAtRaw(u64 offset, void* data, size_t size) const;
+
+    /**
+     * Writes data at the given file offset without touching the file position. Must not be
+     * mixed with buffered writes on the same handle.
+     */
+    template <typename T>
+    size_t WriteAt(u64 offset, std::span<const T> data) const {
+        static_assert(std::is_trivially_copyable_v<T>, "Data type must be trivially copyable.");
+
+        if (!IsOpen()) {
+            return 0;
+        }
+
+        return WriteAtRaw(offset, data.data(), data.size_bytes()) / sizeof(T);
+    }
+
+    size_t WriteAtRaw(u64 offset, const void* data, size_t size) const;
+
+    /**
+     * Writes the buffers back to back starting at the given file offset, using as few system
+     * calls as the platform allows. Returns the number of bytes written.
+     */
+    size_t WriteVectorAt(u64 offset, std::span<const std::span<const u8>> buffers) const;
+
     template <typename T>
     size_t WriteSpan(std::span<const T> data) const {
         static_assert(std::is_trivially_copyable_v<T>, "Data type must be trivially copyable.");
@@ -186,9 +250,7 @@ public:
 
     template <typename T>
     size_t WriteRaw(const void* data, size_t size) const {
-        auto bytes = std::fwrite(data, sizeof(T), size, file);
-        std::fflush(file);
-        return bytes;
+        return std::fwrite(data, sizeof(T), size, file);
     }
 
     template <typename T>
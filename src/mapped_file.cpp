@@ -0,0 +1,125 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "alignment.h"
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#define fileno _fileno
+#endif
+
+namespace Common::FS {
+
+MappedFile::MappedFile() = default;
+
+MappedFile::MappedFile(const std::filesystem::path& path) {
+    Open(path);
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::filesystem::path& path) {
+    Close();
+
+    file.Open(path, FileAccessMode::Read);
+    if (!file.IsOpen()) {
+        return false;
+    }
+
+    size = file.GetSize();
+    if (size == 0) {
+        return true;
+    }
+
+#ifdef _WIN32
+    HANDLE hfile = reinterpret_cast<HANDLE>(_get_osfhandle(fileno(file.file)));
+    HANDLE mapping = CreateFileMappingW(hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr) {
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view != nullptr) {
+            mapping_handle = mapping;
+            data = static_cast<const u8*>(view);
+        } else {
+            CloseHandle(mapping);
+        }
+    }
+#else
+    void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fileno(file.file), 0);
+    if (view != MAP_FAILED) {
+        data = static_cast<const u8*>(view);
+    }
+#endif
+
+    // A failed mapping is not an error, View falls back to reading through the file handle.
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data != nullptr) {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mapping_handle);
+        mapping_handle = nullptr;
+#else
+        munmap(const_cast<u8*>(data), size);
+#endif
+        data = nullptr;
+    }
+    size = 0;
+    file.Close();
+}
+
+bool MappedFile::Advise(u64 offset, u64 length, AccessHint hint) const {
+    if (offset >= size) {
+        return false;
+    }
+    if (length > size - offset) {
+        length = size - offset;
+    }
+
+#ifndef _WIN32
+    if (IsMapped()) {
+        static const u64 page_size = static_cast<u64>(sysconf(_SC_PAGESIZE));
+        u64 start = AlignDown(offset, page_size);
+        u64 end = AlignUp(offset + length, page_size);
+        int advice = MADV_NORMAL;
+        switch (hint) {
+        case AccessHint::Normal:
+            advice = MADV_NORMAL;
+            break;
+        case AccessHint::Sequential:
+            advice = MADV_SEQUENTIAL;
+            break;
+        case AccessHint::WillNeed:
+            advice = MADV_WILLNEED;
+            break;
+        case AccessHint::DontNeed:
+            start = AlignUp(offset, page_size);
+            end = AlignDown(offset + length, page_size);
+            advice = MADV_DONTNEED;
+            break;
+        }
+        if (start < end) {
+            madvise(const_cast<u8*>(data) + start, end - start, advice);
+        }
+        if (hint == AccessHint::DontNeed) {
+            // Dropping the mapping alone keeps the pages cached, tell the file as well.
+            return start < end && file.Advise(start, end - start, hint);
+        }
+    }
+#endif
+
+    return file.Advise(offset, length, hint);
+}
+
+} // namespace Common::FS
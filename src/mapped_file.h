@@ -0,0 +1,110 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "io_file.h"
+#include "types.h"
+
+namespace Common::FS {
+
+/**
+ * Read-only view of a whole file. The file is memory mapped when the platform allows it, so
+ * callers can decode structures straight out of the page cache. Files that cannot be mapped
+ * fall back to positional reads into a caller supplied buffer.
+ */
+class MappedFile final {
+public:
+    MappedFile();
+    explicit MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::filesystem::path& path);
+    void Close();
+
+    bool IsOpen() const {
+        return file.IsOpen();
+    }
+
+    bool IsMapped() const {
+        return data != nullptr;
+    }
+
+    u64 GetSize() const {
+        return size;
+    }
+
+    /// The underlying handle, for positional reads that should bypass the mapping.
+    const IOFile& GetFile() const {
+        return file;
+    }
+
+    /// Returns the whole file, or an empty span if the file is not mapped.
+    std::span<const u8> GetSpan() const {
+        return {data, IsMapped() ? size : 0};
+    }
+
+    /**
+     * Returns the bytes in [offset, offset + length), clamped to the end of the file.
+     * When the file is mapped the span points into the mapping and scratch is left untouched,
+     * otherwise the bytes are read into scratch and the span points there.
+     * Safe to call from several threads at once as long as each uses its own scratch buffer.
+     */
+    template <typename Buffer>
+    std::span<const u8> View(u64 offset, u64 length, Buffer& scratch) const {
+        if (offset >= size) {
+            return {};
+        }
+        if (length > size - offset) {
+            length = size - offset;
+        }
+
+        if (IsMapped()) {
+            return {data + offset, length};
+        }
+
+        scratch.resize(length);
+        const size_t bytes_read = file.ReadAtRaw(offset, scratch.data(), length);
+        return {reinterpret_cast<const u8*>(scratch.data()), bytes_read};
+    }
+
+    /**
+     * Applies the access hint to both the mapping and the file's page cache. WillNeed ranges
+     * are widened to whole pages, DontNeed ranges are narrowed so neighbouring data stays.
+     */
+    bool Advise(u64 offset, u64 length, AccessHint hint) const;
+
+    template <typename T>
+    bool ReadObject(u64 offset, T& object) const {
+        static_assert(std::is_trivially_copyable_v<T>, "Data type must be trivially copyable.");
+
+        if (IsMapped()) {
+            if (offset > size || size - offset < sizeof(T)) {
+                return false;
+            }
+            std::memcpy(&object, data + offset, sizeof(T));
+            return true;
+        }
+        return file.ReadAtRaw(offset, &object, sizeof(T)) == sizeof(T);
+    }
+
+private:
+    IOFile file;
+    const u8* data = nullptr;
+    u64 size = 0;
+
+#ifdef _WIN32
+    void* mapping_handle = nullptr;
+#endif
+};
+
+} // namespace Common::FS
@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "pfs_tree.h"
+
+void PFSTree::Clear() {
+    nodes.clear();
+    names.clear();
+    roots.clear();
+}
+
+void PFSTree::SetRoot(u32 inode, std::filesystem::path path) {
+    for (auto& [root, root_path] : roots) {
+        if (root == inode) {
+            root_path = std::move(path);
+            return;
+        }
+    }
+    roots.emplace_back(inode, std::move(path));
+}
+
+void PFSTree::Add(u32 inode, u32 parent, std::string_view name) {
+    if (inode >= nodes.size()) {
+        nodes.resize(inode + 1);
+    }
+    Node& node = nodes[inode];
+    node.parent = parent;
+    node.name_offset = static_cast<u32>(names.size());
+    node.name_length = static_cast<u32>(name.size());
+    names.append(name);
+}
+
+std::string_view PFSTree::GetName(u32 inode) const {
+    if (inode >= nodes.size()) {
+        return {};
+    }
+    const Node& node = nodes[inode];
+    return std::string_view(names).substr(node.name_offset, node.name_length);
+}
+
+std::filesystem::path PFSTree::GetPath(u32 inode) const {
+    // Collect the chain up to the topmost known node, bounded in case the image has a cycle.
+    std::vector<u32> chain;
+    u32 current = inode;
+    while (current < nodes.size() && nodes[current].parent != NoParent &&
+           chain.size() < nodes.size()) {
+        chain.push_back(current);
+        current = nodes[current].parent;
+    }
+
+    std::filesystem::path path;
+    for (const auto& [root, root_path] : roots) {
+        if (root == current) {
+            path = root_path;
+            break;
+        }
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        path /= GetName(*it);
+    }
+    return path;
+}
@@ -0,0 +1,43 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+
+/**
+ * Directory tree of a PFS image with one small node per inode. Each node only records its
+ * parent and where its name sits in a single shared string arena, so a package with 100k
+ * entries needs a few MB at most. Full paths are put together on demand by walking up to one
+ * of the roots.
+ */
+class PFSTree {
+public:
+    void Clear();
+
+    // Roots are the top level directories, their path is given rather than derived.
+    void SetRoot(u32 inode, std::filesystem::path path);
+    void Add(u32 inode, u32 parent, std::string_view name);
+
+    std::string_view GetName(u32 inode) const;
+    std::filesystem::path GetPath(u32 inode) const;
+
+private:
+    static constexpr u32 NoParent = ~0U;
+
+    struct Node {
+        u32 parent = NoParent;
+        u32 name_offset = 0;
+        u32 name_length = 0;
+    };
+
+    std::vector<Node> nodes; // Indexed by inode number.
+    std::string names;
+    std::vector<std::pair<u32, std::filesystem::path>> roots;
+};
@@ -0,0 +1,69 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "pfsc_inflater.h"
+
+std::string_view GetPfscInflateErrorString(PfscInflateError error) {
+    switch (error) {
+    case PfscInflateError::None:
+        return "No error";
+    case PfscInflateError::OutOfMemory:
+        return "Out of memory while inflating";
+    case PfscInflateError::CorruptData:
+        return "Corrupt compressed data";
+    case PfscInflateError::SizeMismatch:
+        return "Block inflated to the wrong size";
+    }
+    return "Unknown error";
+}
+
+PfscInflater::~PfscInflater() {
+    if (initialized) {
+        inflateEnd(&stream);
+    }
+}
+
+PfscInflateError PfscInflater::Inflate(std::span<const u8> compressed, std::span<char> block) {
+    if (backend == PfscInflateBackend::Zlib) {
+        return InflateZlib(compressed, block);
+    }
+
+    const std::span<u8> output(reinterpret_cast<u8*>(block.data()), block.size());
+    switch (decoder.Decode(compressed, output)) {
+    case Common::ZlibDecodeResult::Success:
+        return PfscInflateError::None;
+    case Common::ZlibDecodeResult::BadData:
+        return PfscInflateError::CorruptData;
+    default:
+        return PfscInflateError::SizeMismatch;
+    }
+}
+
+PfscInflateError PfscInflater::InflateZlib(std::span<const u8> compressed,
+                                           std::span<char> block) {
+    if (!initialized) {
+        if (inflateInit(&stream) != Z_OK) {
+            return PfscInflateError::OutOfMemory;
+        }
+        initialized = true;
+    } else if (inflateReset(&stream) != Z_OK) {
+        return PfscInflateError::CorruptData;
+    }
+
+    stream.next_in = const_cast<Bytef*>(compressed.data());
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    stream.next_out = reinterpret_cast<Bytef*>(block.data());
+    stream.avail_out = static_cast<uInt>(block.size());
+
+    switch (inflate(&stream, Z_FINISH)) {
+    case Z_STREAM_END:
+        return stream.avail_out == 0 ? PfscInflateError::None : PfscInflateError::SizeMismatch;
+    case Z_MEM_ERROR:
+        return PfscInflateError::OutOfMemory;
+    case Z_BUF_ERROR:
+        // Either the input ran out or the block filled up before the stream ended.
+        return PfscInflateError::SizeMismatch;
+    default:
+        return PfscInflateError::CorruptData;
+    }
+}
@@ -0,0 +1,52 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <span>
+#include <string_view>
+#include <zlib.h>
+
+#include "types.h"
+#include "zlib_decoder.h"
+
+enum class PfscInflateError {
+    None,
+    OutOfMemory,  // zlib could not allocate its state.
+    CorruptData,  // The block is not a valid zlib stream.
+    SizeMismatch, // The stream ended early or did not fit in the block.
+};
+
+std::string_view GetPfscInflateErrorString(PfscInflateError error);
+
+enum class PfscInflateBackend {
+    BuiltIn, // Whole block decoder, see Common::ZlibDecoder.
+    Zlib,    // Streaming inflate of the linked zlib-ng.
+};
+
+/**
+ * Inflates compressed PFSC blocks. The decoder tables, or the zlib state and its window, are
+ * set up on first use and reused between blocks, so every worker thread keeps one inflater for
+ * its whole lifetime rather than paying for an inflateInit per 64 KiB block.
+ */
+class PfscInflater {
+public:
+    explicit PfscInflater(PfscInflateBackend backend_ = PfscInflateBackend::BuiltIn)
+        : backend{backend_} {}
+    ~PfscInflater();
+
+    PfscInflater(const PfscInflater&) = delete;
+    PfscInflater& operator=(const PfscInflater&) = delete;
+
+    // Succeeds only if the stream ends exactly when the block is full, which is block_sz2 of the
+    // PFSC header for every block.
+    PfscInflateError Inflate(std::span<const u8> compressed, std::span<char> block);
+
+private:
+    PfscInflateError InflateZlib(std::span<const u8> compressed, std::span<char> block);
+
+    PfscInflateBackend backend;
+    Common::ZlibDecoder decoder;
+    z_stream stream{};
+    bool initialized = false;
+};
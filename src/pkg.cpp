@@ -1,10 +1,17 @@
 // SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
 // SPDX-License-Identifier: GPL-2.0-or-later
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <thread>
 #include <fmt/format.h>
-#include <zlib.h>
 
+#include "alignment.h"
 #include "io_file.h"
+#include "mapped_file.h"
+#include "pfsc_inflater.h"
 #include "pkg.h"
 #include "pkg_type.h"
 
@@ -22,33 +29,220 @@ struct UTF {
 
 } // namespace fmt
 
-static void DecompressPFSC(std::span<char> compressed_data, std::span<char> decompressed_data) {
-    z_stream decompressStream;
-    decompressStream.zalloc = Z_NULL;
-    decompressStream.zfree = Z_NULL;
-    decompressStream.opaque = Z_NULL;
+namespace {
 
-    if (inflateInit(&decompressStream) != Z_OK) {
-        // std::cerr << "Error initializing zlib for deflation." << std::endl;
+// Decrypts parts of the PFS image on demand, touching only the sectors that cover each read.
+class PFSImageReader {
+public:
+    PFSImageReader(const Common::FS::MappedFile& file_, const Crypto& crypto_,
+                   const Common::AesXts::PfsCipherSession& session_, u64 image_offset_,
+                   u64 image_size_)
+        : file{file_}, crypto{crypto_}, session{session_}, image_offset{image_offset_},
+          image_size{image_size_} {}
+
+    u64 GetSize() const {
+        return image_size;
     }
 
-    decompressStream.avail_in = compressed_data.size();
-    decompressStream.next_in = reinterpret_cast<unsigned char*>(compressed_data.data());
-    decompressStream.avail_out = decompressed_data.size();
-    decompressStream.next_out = reinterpret_cast<unsigned char*>(decompressed_data.data());
+    // Decrypts [offset, offset + out.size()) of the PFS image into out.
+    bool Read(u64 offset, std::span<u8> out) {
+        if (offset > image_size || image_size - offset < out.size()) {
+            return false;
+        }
+        const u64 first_sector = offset / 0x1000;
+        const u64 length = Common::AlignUp(offset + out.size(), 0x1000) - first_sector * 0x1000;
+        const auto encrypted = file.View(image_offset + first_sector * 0x1000, length, scratch);
+        if (encrypted.size() != length) {
+            return false;
+        }
+        sectors.resize(length);
+        crypto.decryptPFSParallel(session, encrypted, sectors, first_sector);
+        std::memcpy(out.data(), sectors.data() + (offset & 0xFFF), out.size());
+        return true;
+    }
 
-    if (inflate(&decompressStream, Z_FINISH)) {
+    template <typename T>
+    bool ReadObject(u64 offset, T& object) {
+        return Read(offset, std::span<u8>(reinterpret_cast<u8*>(&object), sizeof(T)));
     }
-    if (inflateEnd(&decompressStream) != Z_OK) {
-        // std::cerr << "Error ending zlib inflate" << std::endl;
+
+private:
+    const Common::FS::MappedFile& file;
+    const Crypto& crypto;
+    const Common::AesXts::PfsCipherSession& session;
+    u64 image_offset;
+    u64 image_size;
+    std::vector<u8> scratch;
+    std::vector<u8> sectors;
+};
+
+// Inflates PFSC metadata blocks ahead of the walk in PKG::Extract. Each batch is read and
+// decrypted in one go and its blocks are inflated across all hardware threads, then handed out
+// in order so the directory tree is still assembled serially.
+class PFSMetadataBlocks {
+public:
+    PFSMetadataBlocks(PFSImageReader& pfs_image_, const std::vector<u64>& sector_map_,
+                      u64 pfsc_offset_, u32 num_blocks_, PfscInflateBackend backend)
+        : pfs_image{pfs_image_}, sector_map{sector_map_}, pfsc_offset{pfsc_offset_},
+          num_blocks{num_blocks_}, num_threads{std::max(1u, std::thread::hardware_concurrency())},
+          batch_size{num_threads * 4}, errors(num_threads) {
+        for (u32 i = 0; i < num_threads; i++) {
+            inflaters.emplace_back(backend);
+        }
+    }
+
+    // Why the last Get failed, if it was a block that would not inflate.
+    PfscInflateError GetError() const {
+        return error;
+    }
+
+    // Returns the decompressed block, or an empty span if it could not be read.
+    std::span<const char> Get(u32 block) {
+        if (block < first_block || block >= first_block + count) {
+            if (!Fill(block)) {
+                return {};
+            }
+        }
+        return std::span<const char>(blocks).subspan((block - first_block) * 0x10000ULL, 0x10000);
     }
+
+private:
+    bool Fill(u32 first) {
+        first_block = first;
+        count = 0;
+        const u32 n = std::min(batch_size, num_blocks - first);
+        const u64 start = sector_map[first];
+        compressed.resize(sector_map[first + n] - start);
+        if (!pfs_image.Read(pfsc_offset + start, compressed)) {
+            return false;
+        }
+        blocks.assign(n * 0x10000ULL, 0);
+        std::fill(errors.begin(), errors.end(), PfscInflateError::None);
+
+        const auto inflate_blocks = [&](u32 worker) {
+            for (u32 i = worker; i < n; i += num_threads) {
+                const u64 sectorOffset = sector_map[first + i] - start;
+                const u64 sectorSize = sector_map[first + i + 1] - sector_map[first + i];
+                const auto compressedData =
+                    std::span<const u8>(compressed).subspan(sectorOffset, sectorSize);
+                const std::span<char> decompressedData(blocks.data() + i * 0x10000ULL, 0x10000);
+                if (sectorSize == 0x10000) // Uncompressed data
+                    std::memcpy(decompressedData.data(), compressedData.data(), 0x10000);
+                else if (sectorSize < 0x10000) { // Compressed data
+                    const auto result = inflaters[worker].Inflate(compressedData, decompressedData);
+                    if (result != PfscInflateError::None) {
+                        errors[worker] = result;
+                        return;
+                    }
+                }
+            }
+        };
+        std::vector<std::jthread> workers;
+        for (u32 worker = 1; worker < std::min(num_threads, n); worker++) {
+            workers.emplace_back(inflate_blocks, worker);
+        }
+        inflate_blocks(0);
+        workers.clear();
+
+        for (const auto result : errors) {
+            if (result != PfscInflateError::None) {
+                error = result;
+                return false;
+            }
+        }
+        count = n;
+        return true;
+    }
+
+    PFSImageReader& pfs_image;
+    const std::vector<u64>& sector_map;
+    u64 pfsc_offset;
+    u32 num_blocks;
+    u32 num_threads;
+    u32 batch_size;
+    u32 first_block = 0;
+    u32 count = 0;
+    std::vector<u8> compressed;
+    std::vector<char> blocks;
+    std::deque<PfscInflater> inflaters; // One per worker.
+    std::vector<PfscInflateError> errors;
+    PfscInflateError error = PfscInflateError::None;
+};
+
+} // Anonymous namespace
+
+// Only the fixed part of a dirent is copied, the name is read in place.
+static Dirent ReadDirent(std::span<const char> block, int offset) {
+    Dirent dirent{};
+    const int available = 0x10000 - offset;
+    std::memcpy(&dirent, block.data() + offset,
+                std::min<int>(offsetof(Dirent, name), available));
+    return dirent;
 }
 
-u32 GetPFSCOffset(std::span<const u8> pfs_image) {
+static std::string_view ReadDirentName(std::span<const char> block, int offset,
+                                       const Dirent& dirent) {
+    const u64 start = offset + offsetof(Dirent, name);
+    if (dirent.namelen < 0 || start > block.size()) {
+        return {};
+    }
+    return std::string_view(block.data() + start, block.size() - start).substr(0, dirent.namelen);
+}
+
+// Copies one PKG entry to sce_sys. NP entries are AES-CBC decrypted a chunk at a time on the
+// way out, each chunk chained to the last ciphertext block of the one before.
+static bool WriteSceSysEntry(Crypto& crypto, const Common::FS::MappedFile& file,
+                             const PKGEntry& entry, const std::filesystem::path& extract_path,
+                             std::span<const u8, 32> dk3, std::vector<u8>& buffer) {
+    static constexpr u64 NpChunkSize = 0x10000;
+
+    // The entry is written straight from the mapped PKG, buffer is only used when the file
+    // could not be mapped.
+    const auto data = file.View(entry.offset, entry.size, buffer);
+    if (data.size() != entry.size) {
+        return false;
+    }
+
+    // Try to figure out the name, or just print with id.
+    const auto name = GetEntryNameByType(entry.id);
+    const auto filepath =
+        extract_path / "sce_sys" / (name.empty() ? std::to_string(entry.id) : std::string{name});
+    Common::FS::IOFile out(filepath, Common::FS::FileAccessMode::Write);
+
+    if (entry.id < 0x400 || entry.id > 0x403) { // somehow 0x401 is not decrypting
+        out.WriteRaw<u8>(data.data(), data.size());
+        return true;
+    }
+
+    std::array<u8, 64> concatenated_ivkey_dk3;
+    std::memcpy(concatenated_ivkey_dk3.data(), &entry, sizeof(entry));
+    std::memcpy(concatenated_ivkey_dk3.data() + sizeof(entry), dk3.data(), dk3.size());
+    std::array<u8, 32> ivKey;
+    crypto.ivKeyHASH256(concatenated_ivkey_dk3, ivKey);
+
+    std::array<u8, NpChunkSize> decrypted;
+    for (u64 pos = 0; pos < data.size(); pos += NpChunkSize) {
+        const u64 length = std::min<u64>(NpChunkSize, data.size() - pos);
+        if (pos != 0) {
+            std::memcpy(ivKey.data(), data.data() + pos - 16, 16);
+        }
+        // Only whole AES blocks are decrypted, a trailing partial block is kept as it is.
+        const u64 blocks = length & ~u64{15};
+        crypto.aesCbcCfb128DecryptEntry(ivKey, data.subspan(pos, blocks),
+                                        std::span(decrypted).first(blocks));
+        std::memcpy(decrypted.data() + blocks, data.data() + pos + blocks, length - blocks);
+        out.WriteRaw<u8>(decrypted.data(), length);
+    }
+    return true;
+}
+
+static u64 GetPFSCOffset(PFSImageReader& pfs_image) {
     static constexpr u32 PfscMagic = 0x43534650;
     u32 value;
-    for (u32 i = 0x20000; i < pfs_image.size(); i += 0x10000) {
-        std::memcpy(&value, &pfs_image[i], sizeof(u32));
+    for (u64 i = 0x20000; i + sizeof(u32) <= pfs_image.GetSize(); i += 0x10000) {
+        if (!pfs_image.ReadObject(i, value)) {
+            break;
+        }
         if (value == PfscMagic)
             return i;
     }
@@ -60,14 +254,13 @@ PKG::PKG() = default;
 PKG::~PKG() = default;
 
 bool PKG::Open(const std::filesystem::path& filepath, std::string& failreason) {
-    Common::FS::IOFile file(filepath, Common::FS::FileAccessMode::Read);
+    Common::FS::MappedFile file(filepath);
     if (!file.IsOpen()) {
         return false;
     }
     pkgSize = file.GetSize();
 
-    file.Read(pkgheader);
-    if (pkgheader.magic != 0x7F434E54)
+    if (!file.ReadObject(0, pkgheader) || pkgheader.magic != 0x7F434E54)
         return false;
 
     for (const auto& flag : flagNames) {
@@ -79,56 +272,49 @@ bool PKG::Open(const std::filesystem::path& filepath, std::string& failreason) {
     }
 
     // Find title id it is part of pkg_content_id starting at offset 0x40
-    file.Seek(0x47); // skip first 7 characters of content_id
-    file.Read(pkgTitleID);
+    std::memcpy(pkgTitleID, pkgheader.pkg_content_id + 7, sizeof(pkgTitleID));
 
     u32 offset = pkgheader.pkg_table_entry_offset;
     u32 n_files = pkgheader.pkg_table_entry_count;
 
-    if (!file.Seek(offset)) {
-        failreason = "Failed to seek to PKG table entry offset";
+    std::vector<u8> table_buffer;
+    const auto table = file.View(offset, u64(n_files) * sizeof(PKGEntry), table_buffer);
+    if (table.size() != u64(n_files) * sizeof(PKGEntry)) {
+        failreason = "Failed to read PKG table entries";
         return false;
     }
 
-    for (int i = 0; i < n_files; i++) {
-        PKGEntry entry{};
-        file.Read(entry.id);
-        file.Read(entry.filename_offset);
-        file.Read(entry.flags1);
-        file.Read(entry.flags2);
-        file.Read(entry.offset);
-        file.Read(entry.size);
-        file.Seek(8, Common::FS::SeekOrigin::CurrentPosition);
+    for (u32 i = 0; i < n_files; i++) {
+        PKGEntry entry;
+        std::memcpy(&entry, table.data() + i * sizeof(PKGEntry), sizeof(PKGEntry));
 
         // Try to figure out the name
         const auto name = GetEntryNameByType(entry.id);
         if (name == "param.sfo") {
-            sfo.clear();
-            if (!file.Seek(entry.offset)) {
-                failreason = "Failed to seek to param.sfo offset";
+            std::vector<u8> sfo_buffer;
+            const auto data = file.View(entry.offset, entry.size, sfo_buffer);
+            if (data.size() != entry.size) {
+                failreason = "Failed to read param.sfo";
                 return false;
             }
-            sfo.resize(entry.size);
-            file.ReadRaw<u8>(sfo.data(), entry.size);
+            sfo.assign(data.begin(), data.end());
         }
     }
-    file.Close();
 
     return true;
 }
 
 bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::path& extract,
-                  std::string& failreason) {
+                  std::string& failreason, PfscInflateBackend inflate_backend) {
     extract_path = extract;
     pkgpath = filepath;
-    Common::FS::IOFile file(filepath, Common::FS::FileAccessMode::Read);
+    Common::FS::MappedFile file(filepath);
     if (!file.IsOpen()) {
         return false;
     }
     pkgSize = file.GetSize();
-    file.ReadRaw<u8>(&pkgheader, sizeof(PKGHeader));
 
-    if (pkgheader.magic != 0x7F434E54)
+    if (!file.ReadObject(0, pkgheader) || pkgheader.magic != 0x7F434E54)
         return false;
 
     if (pkgheader.pkg_size > pkgSize) {
@@ -144,188 +330,165 @@ bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::
     u32 n_files = pkgheader.pkg_table_entry_count;
 
     std::array<u8, 64> concatenated_ivkey_dk3;
-    std::array<u8, 32> seed_digest;
-    std::array<std::array<u8, 32>, 7> digest1;
-    std::array<std::array<u8, 256>, 7> key1;
-    std::array<u8, 256> imgkeydata;
 
-    if (!file.Seek(offset)) {
-        failreason = "Failed to seek to PKG table entry offset";
+    std::vector<u8> table_buffer;
+    const auto table = file.View(offset, u64(n_files) * sizeof(PKGEntry), table_buffer);
+    if (table.size() != u64(n_files) * sizeof(PKGEntry)) {
+        failreason = "Failed to read PKG table entries";
         return false;
     }
-
-    for (int i = 0; i < n_files; i++) {
-        PKGEntry entry{};
-        file.Read(entry.id);
-        file.Read(entry.filename_offset);
-        file.Read(entry.flags1);
-        file.Read(entry.flags2);
-        file.Read(entry.offset);
-        file.Read(entry.size);
-        file.Seek(8, Common::FS::SeekOrigin::CurrentPosition);
-
-        auto currentPos = file.Tell();
-
-        // Try to figure out the name
-        const auto name = GetEntryNameByType(entry.id);
-        const auto filepath = extract_path / "sce_sys" / name;
-        std::filesystem::create_directories(filepath.parent_path());
-
-        if (name.empty()) {
-            // Just print with id
-            Common::FS::IOFile out(extract_path / "sce_sys" / std::to_string(entry.id),
-                                   Common::FS::FileAccessMode::Write);
-            if (!file.Seek(entry.offset)) {
-                failreason = "Failed to seek to PKG entry offset";
-                return false;
-            }
-
-            std::vector<u8> data;
-            data.resize(entry.size);
-            file.ReadRaw<u8>(data.data(), entry.size);
-            out.WriteRaw<u8>(data.data(), entry.size);
-            out.Close();
-
-            file.Seek(currentPos);
-            continue;
+    std::vector<PKGEntry> entries(n_files);
+    std::memcpy(entries.data(), table.data(), table.size());
+
+    const PKGEntry* entry_keys = nullptr;
+    const PKGEntry* image_key = nullptr;
+    for (const auto& entry : entries) {
+        if (u64(entry.offset) + entry.size > pkgSize) {
+            failreason = "Failed to read PKG entry";
+            return false;
         }
-
-        if (entry.id == 0x1) {         // DIGESTS, seek;
-                                       // file.Seek(entry.offset, fsSeekSet);
-        } else if (entry.id == 0x10) { // ENTRY_KEYS, seek;
-            file.Seek(entry.offset);
-            file.Read(seed_digest);
-
-            for (int i = 0; i < 7; i++) {
-                file.Read(digest1[i]);
-            }
-
-            for (int i = 0; i < 7; i++) {
-                file.Read(key1[i]);
-            }
-
-            PKG::crypto.RSA2048Decrypt(dk3_, key1[3], true); // decrypt DK3
-        } else if (entry.id == 0x20) {                       // IMAGE_KEY, seek; IV_KEY
-            file.Seek(entry.offset);
-            file.Read(imgkeydata);
-
-            // The Concatenated iv + dk3 imagekey for HASH256
-            std::memcpy(concatenated_ivkey_dk3.data(), &entry, sizeof(entry));
-            std::memcpy(concatenated_ivkey_dk3.data() + sizeof(entry), dk3_.data(), sizeof(dk3_));
-
-            PKG::crypto.ivKeyHASH256(concatenated_ivkey_dk3, ivKey); // ivkey_
-            // imgkey_ to use for last step to get ekpfs
-            PKG::crypto.aesCbcCfb128Decrypt(ivKey, imgkeydata, imgKey);
-            // ekpfs key to get data and tweak keys.
-            PKG::crypto.RSA2048Decrypt(ekpfsKey, imgKey, false);
-        } else if (entry.id == 0x80) {
-            // GENERAL_DIGESTS, seek;
-            // file.Seek(entry.offset, fsSeekSet);
+        if (entry.id == 0x10) {
+            entry_keys = &entry;
+        } else if (entry.id == 0x20) {
+            image_key = &entry;
         }
+    }
 
-        Common::FS::IOFile out(extract_path / "sce_sys" / name, Common::FS::FileAccessMode::Write);
-        if (!file.Seek(entry.offset)) {
-            failreason = "Failed to seek to PKG entry offset";
+    // DK3 comes first, the NP entries are decrypted with it.
+    std::vector<u8> entry_buffer;
+    if (entry_keys) { // ENTRY_KEYS
+        const auto data = file.View(entry_keys->offset, entry_keys->size, entry_buffer);
+        // seed digest (0x20), 7 digests (0x20 each), then 7 keys (0x100 each).
+        static constexpr u64 Key1Offset = 0x20 + 7 * 0x20;
+        if (data.size() < Key1Offset + 7 * 0x100) {
+            failreason = "ENTRY_KEYS entry is too small";
             return false;
         }
+        const auto key1_3 = data.subspan(Key1Offset + 3 * 0x100).first<0x100>();
+        PKG::crypto.RSA2048Decrypt(dk3_, key1_3, true); // decrypt DK3
+    }
 
-        std::vector<u8> data;
-        data.resize(entry.size);
-        file.ReadRaw<u8>(data.data(), entry.size);
-        out.WriteRaw<u8>(data.data(), entry.size);
-        out.Close();
-
-        // Decrypt Np stuff and overwrite.
-        if (entry.id == 0x400 || entry.id == 0x401 || entry.id == 0x402 ||
-            entry.id == 0x403) { // somehow 0x401 is not decrypting
-            decNp.resize(entry.size);
-            if (!file.Seek(entry.offset)) {
-                failreason = "Failed to seek to PKG entry offset";
-                return false;
+    // Every entry is also copied to sce_sys. That runs on its own threads, each entry read
+    // once and NP entries decrypted on the way out, while the PFS keys are derived below.
+    for (const auto& entry : entries) {
+        const auto name = GetEntryNameByType(entry.id);
+        std::filesystem::create_directories((extract_path / "sce_sys" / name).parent_path());
+    }
+    std::atomic<u32> next_entry{0};
+    std::atomic<bool> entries_failed{false};
+    const auto write_entries = [&] {
+        std::vector<u8> buffer;
+        for (u32 i = next_entry++; i < n_files; i = next_entry++) {
+            if (!WriteSceSysEntry(PKG::crypto, file, entries[i], extract_path, dk3_, buffer)) {
+                entries_failed = true;
             }
+        }
+    };
+    std::vector<std::jthread> entry_writers;
+    const u32 num_writers = std::min(std::max(1u, std::thread::hardware_concurrency()), n_files);
+    for (u32 i = 0; i < num_writers; i++) {
+        entry_writers.emplace_back(write_entries);
+    }
 
-            std::vector<u8> data;
-            data.resize(entry.size);
-            file.ReadRaw<u8>(data.data(), entry.size);
-
-            std::span<u8> cipherNp(data.data(), entry.size);
-            std::array<u8, 64> concatenated_ivkey_dk3_;
-            std::memcpy(concatenated_ivkey_dk3_.data(), &entry, sizeof(entry));
-            std::memcpy(concatenated_ivkey_dk3_.data() + sizeof(entry), dk3_.data(), sizeof(dk3_));
-            PKG::crypto.ivKeyHASH256(concatenated_ivkey_dk3_, ivKey);
-            PKG::crypto.aesCbcCfb128DecryptEntry(ivKey, cipherNp, decNp);
-
-            Common::FS::IOFile out(extract_path / "sce_sys" / name,
-                                   Common::FS::FileAccessMode::Write);
-            out.Write(decNp);
-            out.Close();
+    if (image_key) { // IMAGE_KEY, IV_KEY
+        const auto data = file.View(image_key->offset, image_key->size, entry_buffer);
+        if (data.size() < 0x100) {
+            failreason = "IMAGE_KEY entry is too small";
+            return false;
         }
+        const auto imgkeydata = data.first<0x100>();
+
+        // The Concatenated iv + dk3 imagekey for HASH256
+        std::memcpy(concatenated_ivkey_dk3.data(), image_key, sizeof(PKGEntry));
+        std::memcpy(concatenated_ivkey_dk3.data() + sizeof(PKGEntry), dk3_.data(), sizeof(dk3_));
 
-        file.Seek(currentPos);
+        PKG::crypto.ivKeyHASH256(concatenated_ivkey_dk3, ivKey); // ivkey_
+        // imgkey_ to use for last step to get ekpfs
+        PKG::crypto.aesCbcCfb128Decrypt(ivKey, imgkeydata, imgKey);
+        // ekpfs key to get data and tweak keys.
+        PKG::crypto.RSA2048Decrypt(ekpfsKey, imgKey, false);
     }
 
     // Read the seed
     std::array<u8, 16> seed;
-    if (!file.Seek(pkgheader.pfs_image_offset + 0x370)) {
+    if (!file.ReadObject(pkgheader.pfs_image_offset + 0x370, seed)) {
         failreason = "Failed to seek to PFS image offset";
         return false;
     }
-    file.Read(seed);
 
     // Get data and tweak keys.
     PKG::crypto.PfsGenCryptoKey(ekpfsKey, seed, dataKey, tweakKey);
-    const u32 length = pkgheader.pfs_cache_size * 0x2; // Seems to be ok.
+    pfsCipher.emplace(dataKey, tweakKey);
 
-    int num_blocks = 0;
-    std::vector<u8> pfsc(length);
-    if (length != 0) {
-        // Read encrypted pfs_image
-        std::vector<u8> pfs_encrypted(length);
-        file.Seek(pkgheader.pfs_image_offset);
-        file.Read(pfs_encrypted);
-        file.Close();
-        // Decrypt the pfs_image.
-        std::vector<u8> pfs_decrypted(length);
-        PKG::crypto.decryptPFS(dataKey, tweakKey, pfs_encrypted, pfs_decrypted, 0);
-
-        // Retrieve PFSC from decrypted pfs_image.
-        pfsc_offset = GetPFSCOffset(pfs_decrypted);
-        std::memcpy(pfsc.data(), pfs_decrypted.data() + pfsc_offset, length - pfsc_offset);
+    entry_writers.clear();
+    if (entries_failed) {
+        failreason = "Failed to extract sce_sys entries";
+        return false;
+    }
+
+    // Only the PFSC header, the block table and the metadata blocks visited below are read
+    // and decrypted, straight from the PKG.
+    PFSImageReader pfs_image(file, PKG::crypto, *pfsCipher, pkgheader.pfs_image_offset,
+                             pkgheader.pfs_image_size);
 
+    int num_blocks = 0;
+    if (pfs_image.GetSize() != 0) {
+        // Retrieve PFSC from the pfs_image.
+        pfsc_offset = GetPFSCOffset(pfs_image);
         PFSCHdr pfsChdr;
-        std::memcpy(&pfsChdr, pfsc.data(), sizeof(pfsChdr));
+        if (pfsc_offset >= pfs_image.GetSize() || !pfs_image.ReadObject(pfsc_offset, pfsChdr)) {
+            failreason = "Failed to find PFSC image";
+            return false;
+        }
 
+        // Every block is expected to inflate to exactly 64 KiB.
+        if (pfsChdr.block_sz2 != 0x10000) {
+            failreason = fmt::format("Unsupported PFSC block size {:#x}", pfsChdr.block_sz2);
+            return false;
+        }
         num_blocks = (int)(pfsChdr.data_length / pfsChdr.block_sz2);
         sectorMap.resize(num_blocks + 1); // 8 bytes, need extra 1 to get the last offset.
-
-        for (int i = 0; i < num_blocks + 1; i++) {
-            std::memcpy(&sectorMap[i], pfsc.data() + pfsChdr.block_offsets + i * 8, 8);
+        const std::span<u8> table(reinterpret_cast<u8*>(sectorMap.data()), sectorMap.size() * 8);
+        if (!pfs_image.Read(pfsc_offset + pfsChdr.block_offsets, table)) {
+            failreason = "PFSC block table exceeds the PFS image";
+            return false;
         }
     }
 
+    // The tree goes straight into the plan, files are collected in directory order.
+    plan = {};
+    PFSTree& tree = plan.tree;
+    std::vector<Inode> iNodeBuf;
+    std::vector<u32> fileInodes;
+    u32 current_dir = 0;
     u32 ent_size = 0;
     u32 ndinode = 0;
     int ndinode_counter = 0;
     bool dinode_reached = false;
     bool uroot_reached = false;
-    std::vector<char> compressedData;
-    std::vector<char> decompressedData(0x10000);
+    PFSMetadataBlocks metadata(pfs_image, sectorMap, pfsc_offset, num_blocks, inflate_backend);
 
     // Get iNdoes and Dirents.
     for (int i = 0; i < num_blocks; i++) {
-        const u64 sectorOffset = sectorMap[i];
-        const u64 sectorSize = sectorMap[i + 1] - sectorOffset;
-
-        compressedData.resize(sectorSize);
-        std::memcpy(compressedData.data(), pfsc.data() + sectorOffset, sectorSize);
-
-        if (sectorSize == 0x10000) // Uncompressed data
-            std::memcpy(decompressedData.data(), compressedData.data(), 0x10000);
-        else if (sectorSize < 0x10000) // Compressed data
-            DecompressPFSC(compressedData, decompressedData);
+        const auto decompressedData = metadata.Get(i);
+        if (decompressedData.empty()) {
+            if (metadata.GetError() != PfscInflateError::None) {
+                failreason = fmt::format("Failed to inflate PFS metadata block {}: {}", i,
+                                         GetPfscInflateErrorString(metadata.GetError()));
+            } else {
+                failreason = "PFS metadata exceeds the PFS image";
+            }
+            return false;
+        }
 
         if (i == 0) {
             std::memcpy(&ndinode, decompressedData.data() + 0x30, 4); // number of folders and files
+            // Every inode takes 0xA8 bytes of the metadata, a larger count cannot be genuine.
+            if (u64(ndinode) * 0xA8 > u64(num_blocks) * 0x10000) {
+                failreason = "PFS inode count exceeds the PFS image";
+                return false;
+            }
+            iNodeBuf.reserve(ndinode);
         }
 
         int occupied_blocks =
@@ -335,12 +498,14 @@ bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::
 
         if (i >= 1 && i <= occupied_blocks) { // Get all iNodes, gives type, file size and location.
             for (int p = 0; p < 0x10000; p += 0xA8) {
-                Inode node;
-                std::memcpy(&node, &decompressedData[p], sizeof(node));
-                if (node.Mode == 0) {
+                u16 mode;
+                std::memcpy(&mode, &decompressedData[p], sizeof(mode));
+                if (mode == 0) {
                     break;
                 }
-                iNodeBuf.push_back(node);
+                // The last slot of a block is cut short, keep only the bytes that are there.
+                Inode& node = iNodeBuf.emplace_back();
+                std::memcpy(&node, &decompressedData[p], std::min<int>(sizeof(node), 0x10000 - p));
             }
         }
 
@@ -353,8 +518,7 @@ bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::
 
         if (uroot_reached) {
             for (int i = 0; i < 0x10000; i += ent_size) {
-                Dirent dirent;
-                std::memcpy(&dirent, &decompressedData[i], sizeof(dirent));
+                const Dirent dirent = ReadDirent(decompressedData, i);
                 ent_size = dirent.entsize;
                 if (dirent.ino != 0) {
                     ndinode_counter++;
@@ -366,10 +530,10 @@ bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::
 
                     if (parent_path.filename() != title_id &&
                         !fmt::UTF(extract_path.u8string()).data.ends_with("-patch")) {
-                        extractPaths[ndinode_counter] = parent_path / title_id;
+                        tree.SetRoot(ndinode_counter, parent_path / title_id);
                     } else {
                         // DLCs path has different structure
-                        extractPaths[ndinode_counter] = extract_path;
+                        tree.SetRoot(ndinode_counter, extract_path);
                     }
                     uroot_reached = false;
                     break;
@@ -387,8 +551,7 @@ bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::
         bool end_reached = false;
         if (dinode_reached) {
             for (int j = 0; j < 0x10000; j += ent_size) { // Skip the first parent and child.
-                Dirent dirent;
-                std::memcpy(&dirent, &decompressedData[j], sizeof(dirent));
+                const Dirent dirent = ReadDirent(decompressedData, j);
 
                 // Stop here and continue the main loop
                 if (dirent.ino == 0) {
@@ -396,19 +559,21 @@ bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::
                 }
 
                 ent_size = dirent.entsize;
-                auto& table = fsTable.emplace_back();
-                table.name = std::string(dirent.name, dirent.namelen);
-                table.inode = dirent.ino;
-                table.type = dirent.type;
-
-                if (table.type == PFS_CURRENT_DIR) {
-                    current_dir = extractPaths[table.inode];
+                if (dirent.type == PFS_CURRENT_DIR) {
+                    current_dir = dirent.ino;
                 }
-                extractPaths[table.inode] = current_dir / std::filesystem::path(table.name);
 
-                if (table.type == PFS_FILE || table.type == PFS_DIR) {
-                    if (table.type == PFS_DIR) { // Create dirs.
-                        std::filesystem::create_directory(extractPaths[table.inode]);
+                if (dirent.type == PFS_FILE || dirent.type == PFS_DIR) {
+                    // The tree is indexed by inode, an out of range one would size it at will.
+                    if (static_cast<u32>(dirent.ino) >= ndinode) {
+                        failreason = "PFS entry refers to an inode out of range";
+                        return false;
+                    }
+                    tree.Add(dirent.ino, current_dir, ReadDirentName(decompressedData, j, dirent));
+                    if (dirent.type == PFS_DIR) { // Create dirs.
+                        std::filesystem::create_directory(tree.GetPath(dirent.ino));
+                    } else {
+                        fileInodes.push_back(dirent.ino);
                     }
                     ndinode_counter++;
                     if ((ndinode_counter + 1) == ndinode) // 1 for the image itself (root).
@@ -420,69 +585,146 @@ bool PKG::Extract(const std::filesystem::path& filepath, const std::filesystem::
             }
         }
     }
-    return true;
-}
-
-void PKG::ExtractFiles(const int index) {
-    int inode_number = fsTable[index].inode;
-    int inode_type = fsTable[index].type;
-    std::string inode_name = fsTable[index].name;
 
-    if (inode_type == PFS_FILE) {
-        int sector_loc = iNodeBuf[inode_number].loc;
-        int nblocks = iNodeBuf[inode_number].Blocks;
-        int bsize = iNodeBuf[inode_number].Size;
-
-        Common::FS::IOFile inflated;
-        inflated.Open(extractPaths[inode_number], Common::FS::FileAccessMode::Write);
-
-        Common::FS::IOFile pkgFile; // Open the file for each iteration to avoid conflict.
-        pkgFile.Open(pkgpath, Common::FS::FileAccessMode::Read);
-
-        int size_decompressed = 0;
-        std::vector<char> compressedData;
-        std::vector<char> decompressedData(0x10000);
+    // Freeze what the extraction pipeline needs into the plan, the parse state is not shared.
+    for (const u32 ino : fileInodes) {
+        if (ino >= iNodeBuf.size()) {
+            failreason = "PFS file has no inode";
+            return false;
+        }
+        const Inode& inode = iNodeBuf[ino];
+        if (static_cast<u64>(inode.loc) + inode.Blocks >= sectorMap.size()) {
+            failreason = "PFS file exceeds the PFSC image";
+            return false;
+        }
+        const u32 slot = plan.GetNumberOfFiles();
+        plan.inodes.push_back(ino);
+        plan.sizes.push_back(inode.Size);
+        plan.start_blocks.push_back(inode.loc);
+        plan.block_counts.push_back(inode.Blocks);
+        plan.compressed_sizes.push_back(sectorMap[inode.loc + inode.Blocks] -
+                                        sectorMap[inode.loc]);
+
+        // Split the files into runs of blocks so that big files are spread across the workers.
+        // Empty files have no runs, the extractor creates them up front.
+        for (u32 block = 0; block < inode.Blocks; block += MaxBlocksPerRun) {
+            plan.runs.push_back({slot, block, std::min(MaxBlocksPerRun, inode.Blocks - block)});
+        }
+    }
 
-        u64 pfsc_buf_size = 0x11000; // extra 0x1000
-        std::vector<u8> pfsc(pfsc_buf_size);
-        std::vector<u8> pfs_decrypted(pfsc_buf_size);
+    // Largest files first so none of them is left running alone at the end. The sort is stable
+    // so the runs of a file stay together and in block order.
+    std::stable_sort(plan.runs.begin(), plan.runs.end(),
+                     [this](const PFSBlockRun& a, const PFSBlockRun& b) {
+                         return plan.compressed_sizes[a.slot] > plan.compressed_sizes[b.slot];
+                     });
+    return true;
+}
 
-        for (int j = 0; j < nblocks; j++) {
-            u64 sectorOffset =
-                sectorMap[sector_loc + j]; // offset into PFSC_image and not pfs_image.
-            u64 sectorSize = sectorMap[sector_loc + j + 1] -
-                             sectorOffset; // indicates if data is compressed or not.
-            u64 fileOffset = (pkgheader.pfs_image_offset + pfsc_offset + sectorOffset);
-            u64 currentSector1 =
-                (pfsc_offset + sectorOffset) / 0x1000; // block size is 0x1000 for xts decryption.
+std::pair<u64, u64> PKG::GetBlockRunExtent(const PFSBlockRun& run) const {
+    const u32 loc = plan.start_blocks[run.slot];
+    const u64 start = pfsc_offset + sectorMap[loc + run.first_block];
+    const u64 end = pfsc_offset + sectorMap[loc + run.first_block + run.num_blocks];
+    return {pkgheader.pfs_image_offset + start, end - start};
+}
 
-            int sectorOffsetMask = (sectorOffset + pfsc_offset) & 0xFFFFF000;
-            int previousData = (sectorOffset + pfsc_offset) - sectorOffsetMask;
+void PKG::PrepareBlock(PFSBlockJob& job) const {
+    const u32 loc = plan.start_blocks[job.slot];
+    // offsets into pfs_image, sectorMap is relative to the PFSC image.
+    const u64 start = pfsc_offset + sectorMap[loc + job.first_block];
+    const u64 end = pfsc_offset + sectorMap[loc + job.first_block + job.num_blocks];
+
+    job.sector = start / 0x1000; // block size is 0x1000 for xts decryption.
+    job.pkg_offset = pkgheader.pfs_image_offset + job.sector * 0x1000;
+    job.read_size = Common::AlignUp(end, 0x1000) - job.sector * 0x1000;
+    job.data_offset = start & 0xFFF;
+    job.data_size = end - start;
+
+    // This is to remove the zeros at the end of the file.
+    const u64 first_byte = static_cast<u64>(job.first_block) * 0x10000;
+    job.write_size = std::min<u64>(static_cast<u64>(job.num_blocks) * 0x10000,
+                                   plan.sizes[job.slot] - first_byte);
+}
 
-            pkgFile.Seek(fileOffset - previousData);
-            pkgFile.Read(pfsc);
+bool PKG::ReadBlock(const Common::FS::MappedFile& pkgFile, PFSBlockJob& job) const {
+    PrepareBlock(job);
+    // Points into the mapped PKG, or into job.data if it could not be mapped.
+    job.source = pkgFile.View(job.pkg_offset, job.read_size, job.data);
+    return job.source.size() == job.read_size;
+}
 
-            PKG::crypto.decryptPFS(dataKey, tweakKey, pfsc, pfs_decrypted, currentSector1);
+// An uncompressed block that starts on a sector boundary owns its sectors outright, so it is
+// decrypted straight into the output buffer and never goes through data.
+static bool IsDirectBlock(u64 dataOffset, u64 sectorSize, u64 sourceSize) {
+    return sectorSize == 0x10000 && (dataOffset & 0xFFF) == 0 && dataOffset + 0x10000 <= sourceSize;
+}
 
-            compressedData.resize(sectorSize);
-            std::memcpy(compressedData.data(), pfs_decrypted.data() + previousData, sectorSize);
+void PKG::DecryptBlock(PFSBlockJob& job) const {
+    const u32 loc = plan.start_blocks[job.slot];
+    const u64 base = sectorMap[loc + job.first_block];
+    job.output.resize(static_cast<u64>(job.num_blocks) * 0x10000);
+
+    // Every other block is decrypted into data, neighbours are merged into one range.
+    u64 rangeStart = 0;
+    u64 rangeEnd = 0;
+    const auto decryptRange = [&] {
+        if (rangeStart == rangeEnd) {
+            return;
+        }
+        // When source points into data it was sized by ReadBlock already, so this does not
+        // move it.
+        job.data.resize(job.read_size);
+        PKG::crypto.decryptPFSRange(*pfsCipher, job.source, job.data, job.sector, rangeStart,
+                                    rangeEnd - rangeStart);
+        rangeStart = rangeEnd;
+    };
+
+    for (u32 i = 0; i < job.num_blocks; i++) {
+        const u64 sectorOffset = sectorMap[loc + job.first_block + i];
+        const u64 sectorSize = sectorMap[loc + job.first_block + i + 1] - sectorOffset;
+        const u64 dataOffset = job.data_offset + (sectorOffset - base);
+        if (IsDirectBlock(dataOffset, sectorSize, job.source.size())) {
+            decryptRange();
+            const std::span<u8> output(reinterpret_cast<u8*>(job.output.data()) +
+                                           static_cast<u64>(i) * 0x10000,
+                                       0x10000);
+            PKG::crypto.decryptPFS(*pfsCipher, job.source.subspan(dataOffset, 0x10000), output,
+                                   job.sector + dataOffset / 0x1000);
+            rangeStart = rangeEnd = dataOffset + 0x10000;
+            continue;
+        }
+        if (rangeStart == rangeEnd) {
+            rangeStart = dataOffset;
+        }
+        rangeEnd = dataOffset + sectorSize;
+    }
+    decryptRange();
+}
 
-            if (sectorSize == 0x10000) // Uncompressed data
-                std::memcpy(decompressedData.data(), compressedData.data(), 0x10000);
-            else if (sectorSize < 0x10000) // Compressed data
-                DecompressPFSC(compressedData, decompressedData);
+PfscInflateError PKG::InflateBlock(PFSBlockJob& job, PfscInflater& inflater) const {
+    const u32 loc = plan.start_blocks[job.slot];
+    const u64 base = sectorMap[loc + job.first_block];
+    job.output.resize(static_cast<u64>(job.num_blocks) * 0x10000);
 
-            size_decompressed += 0x10000;
+    for (u32 i = 0; i < job.num_blocks; i++) {
+        const u64 sectorOffset = sectorMap[loc + job.first_block + i];
+        const u64 sectorSize = sectorMap[loc + job.first_block + i + 1] - sectorOffset;
+        const u64 dataOffset = job.data_offset + (sectorOffset - base);
+        const std::span<char> decompressedData(job.output.data() + static_cast<u64>(i) * 0x10000,
+                                               0x10000);
 
-            if (j < nblocks - 1) {
-                inflated.WriteRaw<u8>(decompressedData.data(), decompressedData.size());
-            } else {
-                // This is to remove the zeros at the end of the file.
-                const u32 write_size = decompressedData.size() - (size_decompressed - bsize);
-                inflated.WriteRaw<u8>(decompressedData.data(), write_size);
+        if (IsDirectBlock(dataOffset, sectorSize, job.source.size())) // Already in place
+            continue;
+        if (sectorSize == 0x10000) // Uncompressed data
+            std::memcpy(decompressedData.data(), job.data.data() + dataOffset, 0x10000);
+        else if (sectorSize < 0x10000) { // Compressed data, inflated straight from the sectors
+            const auto compressedData =
+                std::span<const u8>(job.data).subspan(dataOffset, sectorSize);
+            const auto result = inflater.Inflate(compressedData, decompressedData);
+            if (result != PfscInflateError::None) {
+                return result;
             }
         }
-        pkgFile.Close();
-        inflated.Close();
     }
+    return PfscInflateError::None;
 }
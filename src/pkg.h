@@ -5,13 +5,18 @@
 
 #include <array>
 #include <filesystem>
+#include <optional>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "buffer_pool.h"
 #include "crypto.h"
 #include "endian.h"
+#include "io_file.h"
+#include "mapped_file.h"
 #include "pfs.h"
+#include "pfs_tree.h"
+#include "pfsc_inflater.h"
 #include "types.h"
 
 // #include "trp.h"
@@ -103,22 +108,101 @@ struct PKGEntry {
 };
 static_assert(sizeof(PKGEntry) == 32);
 
+// A run of consecutive PFSC blocks belonging to a single file. Large files are split into
+// several runs so one file can be extracted by more than one worker at a time.
+struct PFSBlockRun {
+    u32 slot;        // Slot of the file in the extraction plan.
+    u32 first_block; // First block of the run, relative to the start of the file.
+    u32 num_blocks;
+};
+
+// The files of a PKG as the extraction pipeline sees them. PKG::Extract builds the plan once the
+// PFS metadata is parsed and never modifies it afterwards, so workers on any thread read it
+// without locks or allocations. The per-file vectors are indexed by plan slot.
+struct ExtractionPlan {
+    PFSTree tree;
+    std::vector<u32> inodes;           // Inode of the file in the tree.
+    std::vector<u64> sizes;            // Size in bytes.
+    std::vector<u32> start_blocks;     // First PFSC block.
+    std::vector<u32> block_counts;     // Number of 64 KiB blocks.
+    std::vector<u64> compressed_sizes; // Compressed bytes across all blocks.
+    std::vector<PFSBlockRun> runs;
+
+    u32 GetNumberOfFiles() const {
+        return static_cast<u32>(inodes.size());
+    }
+
+    // Output path, only built when the file is about to be opened.
+    std::filesystem::path GetPath(u32 slot) const {
+        return tree.GetPath(inodes[slot]);
+    }
+
+    u64 GetTotalBlocks() const {
+        u64 total = 0;
+        for (const u32 count : block_counts) {
+            total += count;
+        }
+        return total;
+    }
+};
+
+// A group of consecutive 64 KiB blocks of one file travelling through the extraction pipeline.
+// The blocks sit back to back in the PFSC image, so they are read and decrypted in one pass.
+struct PFSBlockJob {
+    u32 slot;        // Slot of the file in the extraction plan.
+    u32 first_block; // First block of the job, relative to the start of the file.
+    u32 num_blocks;
+    u64 sequence;    // Position of the job when all jobs are taken in PKG order.
+    u64 sector;      // First XTS sector held in data.
+    u64 pkg_offset;  // Offset of that sector in the PKG.
+    u32 read_size;   // Size of the whole sectors that cover the compressed blocks.
+    u32 data_offset; // Offset of the first compressed block inside data.
+    u32 data_size;   // Size of all compressed blocks together.
+    u64 write_size;  // Number of bytes of output that belong to the file.
+    std::span<const u8> source; // Encrypted sectors, in the mapped PKG or in data.
+    Common::AlignedVector<u8> data;
+    Common::AlignedVector<char> output;
+};
+
 class PKG {
 public:
     PKG();
     ~PKG();
 
     bool Open(const std::filesystem::path& filepath, std::string& failreason);
-    void ExtractFiles(const int index);
+    // The backend inflates the compressed PFS metadata, pass the one the extractor will use.
     bool Extract(const std::filesystem::path& filepath, const std::filesystem::path& extract,
-                 std::string& failreason);
+                 std::string& failreason,
+                 PfscInflateBackend inflate_backend = PfscInflateBackend::BuiltIn);
 
     std::vector<u8> sfo;
 
     u32 GetNumberOfFiles() {
-        return fsTable.size();
+        return plan.GetNumberOfFiles();
     }
 
+    const ExtractionPlan& GetExtractionPlan() const {
+        return plan;
+    }
+
+    std::filesystem::path GetPkgPath() const {
+        return pkgpath;
+    }
+
+    // Byte range of the PKG holding the sectors of a run, as {offset, length}.
+    std::pair<u64, u64> GetBlockRunExtent(const PFSBlockRun& run) const;
+
+    // Extraction stages, safe to call concurrently once Extract has succeeded.
+    // PrepareBlock only locates the blocks, ReadBlock also points job.source at their sectors
+    // and returns false if the PKG ends before all of them.
+    // DecryptBlock already writes uncompressed, sector aligned blocks to job.output, so the
+    // output buffer must be in place before it runs. InflateBlock stops at the first block
+    // that does not inflate cleanly, each thread brings its own inflater.
+    void PrepareBlock(PFSBlockJob& job) const;
+    bool ReadBlock(const Common::FS::MappedFile& pkgFile, PFSBlockJob& job) const;
+    void DecryptBlock(PFSBlockJob& job) const;
+    PfscInflateError InflateBlock(PFSBlockJob& job, PfscInflater& inflater) const;
+
     u64 GetPkgSize() {
         return pkgSize;
     }
@@ -152,6 +236,9 @@ public:
          {PKGContentFlag::CUMULATIVE_PATCH, "CUMULATIVE_PATCH"}}};
 
 private:
+    // Files larger than this many 64 KiB blocks (16 MiB) are split into several runs.
+    static constexpr u32 MaxBlocksPerRun = 256;
+
     Crypto crypto;
     // TRP trp;
     u64 pkgSize = 0;
@@ -159,9 +246,7 @@ private:
     PKGHeader pkgheader;
     std::string pkgFlags;
 
-    std::unordered_map<int, std::filesystem::path> extractPaths;
-    std::vector<pfs_fs_table> fsTable;
-    std::vector<Inode> iNodeBuf;
+    ExtractionPlan plan;
     std::vector<u64> sectorMap;
     u64 pfsc_offset;
 
@@ -171,9 +256,9 @@ private:
     std::array<u8, 32> ekpfsKey;
     std::array<u8, 16> dataKey;
     std::array<u8, 16> tweakKey;
-    std::vector<u8> decNp;
+    // Expanded from dataKey and tweakKey once per PKG and shared by every decrypt thread.
+    std::optional<Common::AesXts::PfsCipherSession> pfsCipher;
 
     std::filesystem::path pkgpath;
-    std::filesystem::path current_dir;
     std::filesystem::path extract_path;
 };
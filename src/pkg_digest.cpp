@@ -0,0 +1,200 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <cryptopp/sha.h>
+
+#include "pkg_digest.h"
+
+static_assert(offsetof(PKGHeader, pkg_digest) == 0xFE0);
+
+namespace {
+
+// Hashed per read, large enough that the per-chunk overhead disappears next to SHA-256.
+constexpr u64 ChunkSize = 4_MB;
+
+bool IsEmpty(const std::array<u8, 32>& digest) {
+    return std::all_of(digest.begin(), digest.end(), [](u8 b) { return b == 0; });
+}
+
+std::string_view GetStatusName(DigestStatus status) {
+    switch (status) {
+    case DigestStatus::Passed:
+        return "passed";
+    case DigestStatus::Failed:
+        return "FAILED";
+    case DigestStatus::Truncated:
+        return "FAILED (file truncated)";
+    case DigestStatus::NotChecked:
+        return "not checked";
+    }
+    return "unknown";
+}
+
+} // Anonymous namespace
+
+PKGDigestStream::PKGDigestStream(const PKGHeader& header, const Common::FS::MappedFile& file_)
+    : file{file_} {
+    // The entry digests cover sce_sys entries in a layout this tree does not decode, they are
+    // listed so the report accounts for every digest in the header.
+    const auto set = [](Region& region, std::string_view name, u64 offset, u64 size,
+                        const u8* expected, bool known) {
+        region.name = name;
+        region.offset = offset;
+        region.size = size;
+        std::memcpy(region.expected.data(), expected, region.expected.size());
+        region.known = known;
+    };
+    set(regions[0], "pkg_digest", 0, offsetof(PKGHeader, pkg_digest), header.pkg_digest, true);
+    set(regions[1], "digest_body_digest", header.pkg_body_offset, header.pkg_body_size,
+        header.digest_body_digest, true);
+    set(regions[2], "pfs_image_digest", header.pfs_image_offset, header.pfs_image_size,
+        header.pfs_image_digest, true);
+    set(regions[3], "pfs_signed_digest", header.pfs_image_offset, header.pfs_signed_size,
+        header.pfs_signed_digest, true);
+    set(regions[4], "digest_entries1", 0, 0, header.digest_entries1, false);
+    set(regions[5], "digest_entries2", 0, 0, header.digest_entries2, false);
+    set(regions[6], "digest_table_digest", 0, 0, header.digest_table_digest, false);
+
+    for (auto& region : regions) {
+        region.hashed = region.known && !IsEmpty(region.expected) &&
+                        region.offset <= file.GetSize() &&
+                        file.GetSize() - region.offset >= region.size;
+    }
+}
+
+PKGDigestStream::~PKGDigestStream() = default;
+
+bool PKGDigestStream::Feed(u64 sequence, u64 offset, std::span<const u8> data) {
+    {
+        std::unique_lock lock{mutex};
+        turn_cv.wait(lock, [&] { return cancelled || sequence == next_sequence; });
+        if (cancelled) {
+            return false;
+        }
+        if (HashFile(offset, nullptr) && offset + data.size() > cursor) {
+            Hash(data.subspan(cursor - offset));
+        }
+        next_sequence++;
+    }
+    turn_cv.notify_all();
+    return true;
+}
+
+void PKGDigestStream::Cancel() {
+    {
+        std::scoped_lock lock{mutex};
+        cancelled = true;
+    }
+    turn_cv.notify_all();
+}
+
+DigestReport PKGDigestStream::Finish(const std::atomic<bool>* cancel) {
+    std::scoped_lock lock{mutex};
+    if (!cancelled) {
+        HashFile(~0ULL, cancel);
+    }
+
+    DigestReport report(regions.size());
+    for (std::size_t i = 0; i < regions.size(); i++) {
+        Region& region = regions[i];
+        DigestStatus status = DigestStatus::NotChecked;
+        if (!region.hashed) {
+            if (region.known && !IsEmpty(region.expected)) {
+                status = DigestStatus::Truncated;
+            }
+        } else if (cursor >= region.offset + region.size) {
+            std::array<u8, CryptoPP::SHA256::DIGESTSIZE> digest;
+            region.sha256.Final(digest.data());
+            status = digest == region.expected ? DigestStatus::Passed : DigestStatus::Failed;
+        } else if (truncated) {
+            status = DigestStatus::Truncated;
+        }
+        report[i] = {region.name, region.offset, region.size, status};
+    }
+    return report;
+}
+
+u64 PKGDigestStream::CoveredUntil(u64 offset) const {
+    u64 end = offset;
+    for (bool extended = true; extended;) {
+        extended = false;
+        for (const auto& region : regions) {
+            if (region.hashed && region.offset <= end && end < region.offset + region.size) {
+                end = region.offset + region.size;
+                extended = true;
+            }
+        }
+    }
+    return end;
+}
+
+u64 PKGDigestStream::NextCovered(u64 offset) const {
+    u64 next = ~0ULL;
+    for (const auto& region : regions) {
+        if (region.hashed && offset < region.offset + region.size) {
+            next = std::min(next, std::max(offset, region.offset));
+        }
+    }
+    return next;
+}
+
+void PKGDigestStream::Hash(std::span<const u8> data) {
+    for (auto& region : regions) {
+        const u64 begin = std::max(cursor, region.offset);
+        const u64 end = std::min(cursor + data.size(), region.offset + region.size);
+        if (region.hashed && begin < end) {
+            region.sha256.Update(data.data() + (begin - cursor), end - begin);
+        }
+    }
+    cursor += data.size();
+}
+
+bool PKGDigestStream::HashFile(u64 until, const std::atomic<bool>* cancel) {
+    while (!truncated) {
+        // Bytes no region covers are skipped rather than read.
+        const u64 start = std::max(cursor, NextCovered(cursor));
+        if (start >= until) {
+            cursor = std::max(cursor, until);
+            return true;
+        }
+        if (cancel && *cancel) {
+            return false;
+        }
+        cursor = start;
+        const u64 length = std::min({ChunkSize, until - cursor, CoveredUntil(cursor) - cursor});
+        const auto data = file.View(cursor, length, buffer);
+        if (data.size() != length) {
+            truncated = true;
+            break;
+        }
+        Hash(data);
+    }
+    return false;
+}
+
+DigestReport VerifyPKGDigests(const PKGHeader& header, const Common::FS::MappedFile& file,
+                              const std::atomic<bool>* cancel) {
+    PKGDigestStream stream(header, file);
+    return stream.Finish(cancel);
+}
+
+bool AnyDigestFailed(const DigestReport& report) {
+    return std::any_of(report.begin(), report.end(), [](const DigestResult& result) {
+        return result.status == DigestStatus::Failed || result.status == DigestStatus::Truncated;
+    });
+}
+
+std::string FormatDigestReport(const DigestReport& report) {
+    std::string text;
+    for (const auto& result : report) {
+        text.append(result.name);
+        text.append(": ");
+        text.append(GetStatusName(result.status));
+        text.push_back('\n');
+    }
+    return text;
+}
@@ -0,0 +1,107 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cryptopp/sha.h>
+
+#include "mapped_file.h"
+#include "pkg.h"
+#include "types.h"
+
+enum class DigestStatus {
+    Passed,
+    Failed,     // The region hashes to something else.
+    Truncated,  // The region extends past the end of the file.
+    NotChecked, // No digest is recorded, or the region it covers is not known.
+};
+
+// Outcome for one of the SHA-256 digests in the PKG header.
+struct DigestResult {
+    std::string_view name; // Name of the header field.
+    u64 offset;            // Byte range of the PKG the digest covers.
+    u64 size;
+    DigestStatus status;
+};
+
+using DigestReport = std::vector<DigestResult>;
+
+/**
+ * Computes the digests of a PKG header in one pass over the file, front to back. The extraction
+ * readers hand in the sectors they read through Feed, and the stream reads the rest of the
+ * covered bytes, like the header, the body and the PFS metadata, from the file itself, so no
+ * byte is read twice. Regions that overlap, like the PFS image and its signed prefix, are
+ * hashed into both digests from the same bytes. Crypto++ picks the SHA extensions when the CPU
+ * has them.
+ */
+class PKGDigestStream {
+public:
+    PKGDigestStream(const PKGHeader& header, const Common::FS::MappedFile& file);
+    ~PKGDigestStream();
+
+    PKGDigestStream(const PKGDigestStream&) = delete;
+    PKGDigestStream& operator=(const PKGDigestStream&) = delete;
+
+    /**
+     * Hashes data, the bytes of the PKG at offset, once everything with a lower sequence number
+     * has been fed. Sequence numbers start at 0 and must follow the file order, bytes that were
+     * already hashed are skipped. Blocks until it is the caller's turn and returns false if the
+     * stream was cancelled in the meantime.
+     */
+    bool Feed(u64 sequence, u64 offset, std::span<const u8> data);
+
+    // Stops the hashing and wakes up every caller waiting in Feed.
+    void Cancel();
+
+    /**
+     * Hashes whatever is left past the last bytes fed and returns the report. Regions not
+     * finished because the stream was cancelled, or the optional flag was set, are reported as
+     * not checked.
+     */
+    DigestReport Finish(const std::atomic<bool>* cancel = nullptr);
+
+private:
+    struct Region {
+        std::string_view name;
+        u64 offset;
+        u64 size;
+        std::array<u8, 32> expected;
+        bool known;  // False if it is not established which bytes the digest covers.
+        bool hashed; // Known, recorded and within the file, the others are not hashed at all.
+        CryptoPP::SHA256 sha256;
+    };
+
+    u64 NextCovered(u64 offset) const;
+    u64 CoveredUntil(u64 offset) const;
+    void Hash(std::span<const u8> data);
+    bool HashFile(u64 until, const std::atomic<bool>* cancel);
+
+    const Common::FS::MappedFile& file;
+    std::array<Region, 7> regions;
+    std::vector<u8> buffer;
+
+    std::mutex mutex;
+    std::condition_variable turn_cv;
+    u64 next_sequence = 0;
+    u64 cursor = 0; // Everything before this is hashed.
+    bool cancelled = false;
+    bool truncated = false;
+};
+
+// Checks the digests of a PKG header against the file without extracting it.
+DigestReport VerifyPKGDigests(const PKGHeader& header, const Common::FS::MappedFile& file,
+                              const std::atomic<bool>* cancel = nullptr);
+
+// Regions that were not checked do not count as failures.
+bool AnyDigestFailed(const DigestReport& report);
+
+// One line per region, "name: status".
+std::string FormatDigestReport(const DigestReport& report);
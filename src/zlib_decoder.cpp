@@ -0,0 +1,548 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <zlib.h>
+
+#include "zlib_decoder.h"
+
+namespace Common {
+
+namespace {
+
+// Decode table entries pack everything needed to act on a symbol:
+//   bits 0-7   bits taken by the codeword, or by the main table for a subtable pointer
+//   bits 8-11  extra bits that follow the symbol, or the index bits of a subtable
+//   bits 12-15 flags
+//   bits 16-31 literal byte, length or offset base, precode symbol or subtable start
+constexpr u32 EntryLiteral = 1U << 12;
+constexpr u32 EntryEndOfBlock = 1U << 13;
+constexpr u32 EntrySubtable = 1U << 14;
+constexpr u32 EntryInvalid = 1U << 15;
+
+constexpr u32 LitlenTableBits = 11;
+constexpr u32 OffsetTableBits = 8;
+constexpr u32 PrecodeTableBits = 7;
+
+constexpr u32 MaxCodewordLength = 15;
+constexpr u32 MaxPrecodeLength = 7;
+constexpr u32 NumLitlenSymbols = 288;
+constexpr u32 NumOffsetSymbols = 32;
+constexpr u32 NumPrecodeSymbols = 19;
+
+// Matches are copied in chunks of this size and may write up to one chunk past their end.
+constexpr std::size_t CopyChunk = 16;
+
+constexpr u32 MakeEntry(u32 value, u32 extra, u32 flags) {
+    return value << 16 | extra << 8 | flags;
+}
+
+constexpr u32 EntryBits(u32 entry) {
+    return entry & 0xFF;
+}
+
+constexpr u32 EntryExtra(u32 entry) {
+    return (entry >> 8) & 0xF;
+}
+
+constexpr u32 EntryValue(u32 entry) {
+    return entry >> 16;
+}
+
+constexpr u64 Mask(u32 bits) {
+    return (u64{1} << bits) - 1;
+}
+
+constexpr std::array<u16, 29> LengthBase = {3,  4,  5,  6,  7,  8,  9,  10,  11,  13,
+                                            15, 17, 19, 23, 27, 31, 35, 43,  51,  59,
+                                            67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::array<u8, 29> LengthExtra = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                            2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::array<u16, 30> OffsetBase = {1,    2,    3,    4,    5,    7,     9,     13,
+                                            17,   25,   33,   49,   65,   97,    129,   193,
+                                            257,  385,  513,  769,  1025, 1537,  2049,  3073,
+                                            4097, 6145, 8193, 12289, 16385, 24577};
+constexpr std::array<u8, 30> OffsetExtra = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                            6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr std::array<u8, NumPrecodeSymbols> PrecodeOrder = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                                            11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+constexpr std::array<u32, NumLitlenSymbols> LitlenResults = [] {
+    std::array<u32, NumLitlenSymbols> results{};
+    for (u32 symbol = 0; symbol < 256; symbol++) {
+        results[symbol] = MakeEntry(symbol, 0, EntryLiteral);
+    }
+    results[256] = MakeEntry(0, 0, EntryEndOfBlock);
+    for (u32 i = 0; i < LengthBase.size(); i++) {
+        results[257 + i] = MakeEntry(LengthBase[i], LengthExtra[i], 0);
+    }
+    results[286] = results[287] = EntryInvalid;
+    return results;
+}();
+
+constexpr std::array<u32, NumOffsetSymbols> OffsetResults = [] {
+    std::array<u32, NumOffsetSymbols> results{};
+    for (u32 i = 0; i < OffsetBase.size(); i++) {
+        results[i] = MakeEntry(OffsetBase[i], OffsetExtra[i], 0);
+    }
+    results[30] = results[31] = EntryInvalid;
+    return results;
+}();
+
+constexpr std::array<u32, NumPrecodeSymbols> PrecodeResults = [] {
+    std::array<u32, NumPrecodeSymbols> results{};
+    for (u32 symbol = 0; symbol < NumPrecodeSymbols; symbol++) {
+        results[symbol] = MakeEntry(symbol, 0, 0);
+    }
+    return results;
+}();
+
+/**
+ * Builds the decode table of a canonical Huffman code. Codewords up to table_bits long are
+ * replicated across the main table, longer ones go to subtables placed after it. Like zlib,
+ * an incomplete code is only accepted if it is a single codeword of one bit, and a code with
+ * no codewords at all leaves every entry invalid.
+ */
+bool BuildDecodeTable(std::span<u32> table, const u8* lens, u32 num_symbols, const u32* results,
+                      u32 table_bits, u32 max_length) {
+    std::array<u32, MaxCodewordLength + 1> count{};
+    for (u32 symbol = 0; symbol < num_symbols; symbol++) {
+        count[lens[symbol]]++;
+    }
+
+    const u32 main_size = 1U << table_bits;
+    std::fill(table.begin(), table.begin() + main_size, EntryInvalid);
+    u32 longest = max_length;
+    while (longest > 0 && count[longest] == 0) {
+        longest--;
+    }
+    if (longest == 0) {
+        return true;
+    }
+
+    s32 left = 1;
+    for (u32 len = 1; len <= max_length; len++) {
+        left <<= 1;
+        left -= static_cast<s32>(count[len]);
+        if (left < 0) {
+            return false;
+        }
+    }
+    if (left > 0 && longest != 1) {
+        return false;
+    }
+
+    // Symbols ordered by codeword length, then by value, is the order codewords are assigned.
+    std::array<u32, MaxCodewordLength + 2> offsets{};
+    for (u32 len = 1; len <= max_length; len++) {
+        offsets[len + 1] = offsets[len] + count[len];
+    }
+    std::array<u16, NumLitlenSymbols> sorted;
+    for (u32 symbol = 0; symbol < num_symbols; symbol++) {
+        if (lens[symbol] != 0) {
+            sorted[offsets[lens[symbol]]++] = static_cast<u16>(symbol);
+        }
+    }
+
+    // Codewords still to be placed for each length, used to size subtables.
+    std::array<u32, MaxCodewordLength + 1> remaining = count;
+    u32 code = 0;
+    u32 next = 0;
+    u32 subtable_prefix = ~0U;
+    u32 subtable_start = 0;
+    u32 subtable_bits = 0;
+    u32 table_end = main_size;
+    for (u32 len = 1; len <= longest; len++) {
+        for (u32 n = 0; n < count[len]; n++, code++) {
+            const u32 symbol = sorted[next++];
+            // Deflate sends codewords from the most significant bit, the bit reader hands
+            // them out least significant first.
+            u32 bits = 0;
+            for (u32 i = 0; i < len; i++) {
+                bits |= ((code >> i) & 1) << (len - 1 - i);
+            }
+
+            if (len <= table_bits) {
+                for (u32 i = bits; i < main_size; i += 1U << len) {
+                    table[i] = results[symbol] | len;
+                }
+                remaining[len]--;
+                continue;
+            }
+
+            const u32 prefix = bits & (main_size - 1);
+            if (prefix != subtable_prefix) {
+                // Grow the subtable until it holds every remaining codeword with this prefix.
+                subtable_bits = len - table_bits;
+                s32 room = 1 << subtable_bits;
+                while (subtable_bits + table_bits < longest) {
+                    room -= static_cast<s32>(remaining[subtable_bits + table_bits]);
+                    if (room <= 0) {
+                        break;
+                    }
+                    subtable_bits++;
+                    room <<= 1;
+                }
+                if (table_end + (1U << subtable_bits) > table.size()) {
+                    return false;
+                }
+                subtable_prefix = prefix;
+                subtable_start = table_end;
+                table_end += 1U << subtable_bits;
+                std::fill(table.begin() + subtable_start, table.begin() + table_end,
+                          EntryInvalid);
+                table[prefix] = MakeEntry(subtable_start, subtable_bits, EntrySubtable) |
+                                table_bits;
+            }
+            const u32 sub_len = len - table_bits;
+            for (u32 i = bits >> table_bits; i < (1U << subtable_bits); i += 1U << sub_len) {
+                table[subtable_start + i] = results[symbol] | sub_len;
+            }
+            remaining[len]--;
+        }
+        code <<= 1;
+    }
+    return true;
+}
+
+struct FixedTables {
+    std::array<u32, ZlibDecoder::LitlenTableSize> litlen;
+    std::array<u32, ZlibDecoder::OffsetTableSize> offset;
+
+    FixedTables() {
+        std::array<u8, NumLitlenSymbols + NumOffsetSymbols> lens;
+        std::fill(lens.begin(), lens.begin() + 144, 8);
+        std::fill(lens.begin() + 144, lens.begin() + 256, 9);
+        std::fill(lens.begin() + 256, lens.begin() + 280, 7);
+        std::fill(lens.begin() + 280, lens.begin() + NumLitlenSymbols, 8);
+        std::fill(lens.begin() + NumLitlenSymbols, lens.end(), 5);
+        BuildDecodeTable(litlen, lens.data(), NumLitlenSymbols, LitlenResults.data(),
+                         LitlenTableBits, MaxCodewordLength);
+        BuildDecodeTable(offset, lens.data() + NumLitlenSymbols, NumOffsetSymbols,
+                         OffsetResults.data(), OffsetTableBits, MaxCodewordLength);
+    }
+};
+
+const FixedTables& GetFixedTables() {
+    static const FixedTables tables;
+    return tables;
+}
+
+} // Anonymous namespace
+
+// Least significant bit first reader over the whole input. Refills load eight bytes at once
+// and keep at least 56 bits buffered, which covers the longest symbol with its extra bits for
+// both a length and an offset. Reads past the end produce zeros and are counted, the stream
+// is truncated if any of them is actually consumed.
+class ZlibDecoder::BitReader {
+public:
+    explicit BitReader(std::span<const u8> input_) : input{input_} {}
+
+    void Refill() {
+        if (input.size() - position >= 8) {
+            u64 word;
+            std::memcpy(&word, input.data() + position, sizeof(word));
+            if constexpr (std::endian::native == std::endian::big) {
+                word = std::byteswap(word);
+            }
+            buffer |= word << available;
+            position += (63 - available) >> 3;
+            available |= 56;
+            return;
+        }
+        while (available < 56) {
+            const u64 byte = position < input.size() ? input[position++] : (overread++, 0);
+            buffer |= byte << available;
+            available += 8;
+        }
+    }
+
+    u32 Peek(u32 bits) const {
+        return static_cast<u32>(buffer & Mask(bits));
+    }
+
+    void Consume(u32 bits) {
+        buffer >>= bits;
+        available -= bits;
+    }
+
+    u32 Pop(u32 bits) {
+        const u32 value = Peek(bits);
+        Consume(bits);
+        return value;
+    }
+
+    u32 Decode(const u32* table, u32 table_bits) {
+        u32 entry = table[Peek(table_bits)];
+        if (entry & EntrySubtable) {
+            Consume(table_bits);
+            entry = table[EntryValue(entry) + Peek(EntryExtra(entry))];
+        }
+        Consume(EntryBits(entry));
+        return entry;
+    }
+
+    // Drops the rest of the current byte and hands the unread bytes back to the input. Returns
+    // false if padding had already been consumed.
+    bool AlignToByte() {
+        const u32 unread = available / 8;
+        if (unread < overread) {
+            return false;
+        }
+        position -= unread - overread;
+        overread = 0;
+        buffer = 0;
+        available = 0;
+        return true;
+    }
+
+    bool IsOverrun() const {
+        return overread > sizeof(buffer);
+    }
+
+    std::span<const u8> Remaining() const {
+        return input.subspan(position);
+    }
+
+    void Skip(std::size_t bytes) {
+        position += bytes;
+    }
+
+private:
+    std::span<const u8> input;
+    std::size_t position = 0;
+    u32 overread = 0;
+    u64 buffer = 0;
+    u32 available = 0;
+};
+
+ZlibDecodeResult ZlibDecoder::ReadDynamicTables(BitReader& reader) {
+    reader.Refill();
+    const u32 num_litlen = reader.Pop(5) + 257;
+    const u32 num_offset = reader.Pop(5) + 1;
+    const u32 num_precode = reader.Pop(4) + 4;
+    if (num_litlen > 286 || num_offset > 30) {
+        return ZlibDecodeResult::BadData;
+    }
+
+    std::array<u8, NumPrecodeSymbols> precode_lens{};
+    for (u32 i = 0; i < num_precode; i++) {
+        reader.Refill();
+        precode_lens[PrecodeOrder[i]] = static_cast<u8>(reader.Pop(3));
+    }
+    if (!BuildDecodeTable(precode_table, precode_lens.data(), NumPrecodeSymbols,
+                          PrecodeResults.data(), PrecodeTableBits, MaxPrecodeLength)) {
+        return ZlibDecodeResult::BadData;
+    }
+
+    std::array<u8, NumLitlenSymbols + NumOffsetSymbols> lens{};
+    const u32 total = num_litlen + num_offset;
+    for (u32 i = 0; i < total;) {
+        reader.Refill();
+        const u32 entry = reader.Decode(precode_table.data(), PrecodeTableBits);
+        if (entry & EntryInvalid) {
+            return ZlibDecodeResult::BadData;
+        }
+        const u32 symbol = EntryValue(entry);
+        if (symbol < 16) {
+            lens[i++] = static_cast<u8>(symbol);
+            continue;
+        }
+
+        u8 value = 0;
+        u32 repeat;
+        if (symbol == 16) {
+            if (i == 0) {
+                return ZlibDecodeResult::BadData;
+            }
+            value = lens[i - 1];
+            repeat = 3 + reader.Pop(2);
+        } else if (symbol == 17) {
+            repeat = 3 + reader.Pop(3);
+        } else {
+            repeat = 11 + reader.Pop(7);
+        }
+        if (repeat > total - i) {
+            return ZlibDecodeResult::BadData;
+        }
+        std::fill_n(lens.begin() + i, repeat, value);
+        i += repeat;
+    }
+    if (reader.IsOverrun()) {
+        return ZlibDecodeResult::Truncated;
+    }
+
+    // Without an end of block symbol the block could never finish.
+    if (lens[256] == 0) {
+        return ZlibDecodeResult::BadData;
+    }
+    std::array<u8, NumOffsetSymbols> offset_lens{};
+    std::copy_n(lens.begin() + num_litlen, num_offset, offset_lens.begin());
+    std::fill(lens.begin() + num_litlen, lens.end(), 0);
+    if (!BuildDecodeTable(litlen_table, lens.data(), NumLitlenSymbols, LitlenResults.data(),
+                          LitlenTableBits, MaxCodewordLength) ||
+        !BuildDecodeTable(offset_table, offset_lens.data(), NumOffsetSymbols,
+                          OffsetResults.data(), OffsetTableBits, MaxCodewordLength)) {
+        return ZlibDecodeResult::BadData;
+    }
+    return ZlibDecodeResult::Success;
+}
+
+ZlibDecodeResult ZlibDecoder::Decode(std::span<const u8> input, std::span<u8> output) {
+    // Two byte header: deflate with a window of at most 32 KiB and no preset dictionary.
+    if (input.size() < 2) {
+        return ZlibDecodeResult::Truncated;
+    }
+    const u32 cmf = input[0];
+    const u32 flg = input[1];
+    if ((cmf & 0xF) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20)) {
+        return ZlibDecodeResult::BadData;
+    }
+
+    BitReader reader(input.subspan(2));
+    u8* const out_begin = output.data();
+    u8* const out_end = out_begin + output.size();
+    u8* out = out_begin;
+
+    bool final_block = false;
+    while (!final_block) {
+        reader.Refill();
+        if (reader.IsOverrun()) {
+            return ZlibDecodeResult::Truncated;
+        }
+        final_block = reader.Pop(1) != 0;
+        const u32 type = reader.Pop(2);
+
+        if (type == 0) {
+            // Stored block, copied as is.
+            if (!reader.AlignToByte()) {
+                return ZlibDecodeResult::Truncated;
+            }
+            const auto header = reader.Remaining();
+            if (header.size() < 4) {
+                return ZlibDecodeResult::Truncated;
+            }
+            const u32 len = header[0] | (header[1] << 8);
+            const u32 nlen = header[2] | (header[3] << 8);
+            if (len != (~nlen & 0xFFFF)) {
+                return ZlibDecodeResult::BadData;
+            }
+            if (header.size() - 4 < len) {
+                return ZlibDecodeResult::Truncated;
+            }
+            if (static_cast<std::size_t>(out_end - out) < len) {
+                return ZlibDecodeResult::InsufficientSpace;
+            }
+            std::memcpy(out, header.data() + 4, len);
+            out += len;
+            reader.Skip(4 + len);
+            continue;
+        }
+
+        const u32* litlen = litlen_table.data();
+        const u32* offsets = offset_table.data();
+        if (type == 1) {
+            litlen = GetFixedTables().litlen.data();
+            offsets = GetFixedTables().offset.data();
+        } else if (type == 2) {
+            const auto result = ReadDynamicTables(reader);
+            if (result != ZlibDecodeResult::Success) {
+                return result;
+            }
+        } else {
+            return ZlibDecodeResult::BadData;
+        }
+
+        for (;;) {
+            reader.Refill();
+            u32 entry = reader.Decode(litlen, LitlenTableBits);
+            if (entry & EntryLiteral) {
+                if (out == out_end) {
+                    return ZlibDecodeResult::InsufficientSpace;
+                }
+                *out++ = static_cast<u8>(EntryValue(entry));
+                continue;
+            }
+            if (entry & EntryEndOfBlock) {
+                break;
+            }
+            if (entry & EntryInvalid) {
+                return ZlibDecodeResult::BadData;
+            }
+            const u32 length = EntryValue(entry) + reader.Pop(EntryExtra(entry));
+
+            entry = reader.Decode(offsets, OffsetTableBits);
+            if (entry & EntryInvalid) {
+                return ZlibDecodeResult::BadData;
+            }
+            const u32 offset = EntryValue(entry) + reader.Pop(EntryExtra(entry));
+            if (offset > static_cast<std::size_t>(out - out_begin)) {
+                return ZlibDecodeResult::BadData;
+            }
+            const std::size_t space = out_end - out;
+            if (length > space) {
+                return ZlibDecodeResult::InsufficientSpace;
+            }
+
+            const u8* src = out - offset;
+            u8* dst = out;
+            out += length;
+            if (space < length + CopyChunk) {
+                // Too close to the end of the output to copy past the match.
+                while (dst != out) {
+                    *dst++ = *src++;
+                }
+            } else if (offset >= CopyChunk) {
+                do {
+                    std::memcpy(dst, src, CopyChunk);
+                    dst += CopyChunk;
+                    src += CopyChunk;
+                } while (dst < out);
+            } else if (offset == 1) {
+                // A run of one byte.
+                u8 run[CopyChunk];
+                std::memset(run, *src, CopyChunk);
+                do {
+                    std::memcpy(dst, run, CopyChunk);
+                    dst += CopyChunk;
+                } while (dst < out);
+            } else if (offset >= 8) {
+                do {
+                    std::memcpy(dst, src, 8);
+                    dst += 8;
+                    src += 8;
+                } while (dst < out);
+            } else {
+                while (dst != out) {
+                    *dst++ = *src++;
+                }
+            }
+        }
+        if (reader.IsOverrun()) {
+            return ZlibDecodeResult::Truncated;
+        }
+    }
+
+    // Big endian Adler-32 of the output follows the last block.
+    if (!reader.AlignToByte()) {
+        return ZlibDecodeResult::Truncated;
+    }
+    const auto trailer = reader.Remaining();
+    if (trailer.size() < 4) {
+        return ZlibDecodeResult::Truncated;
+    }
+    if (out != out_end) {
+        return ZlibDecodeResult::ShortOutput;
+    }
+    const u32 expected = (trailer[0] << 24) | (trailer[1] << 16) | (trailer[2] << 8) | trailer[3];
+    const uLong checksum = adler32(adler32(0, nullptr, 0), out_begin,
+                                   static_cast<uInt>(output.size()));
+    if (checksum != expected) {
+        return ZlibDecodeResult::BadData;
+    }
+    return ZlibDecodeResult::Success;
+}
+
+} // namespace Common
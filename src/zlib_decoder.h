@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+
+#include "types.h"
+
+namespace Common {
+
+enum class ZlibDecodeResult {
+    Success,
+    BadData,           // Not a valid zlib stream, or its checksum does not match.
+    Truncated,         // The input ends in the middle of the stream.
+    ShortOutput,       // The stream ended before the output was full.
+    InsufficientSpace, // The output filled up before the stream ended.
+};
+
+/**
+ * Decodes a whole zlib stream into an output buffer of known size in a single call. With both
+ * buffers complete up front there is no state to save between calls, so symbols are decoded
+ * straight from a 64-bit bit buffer through flat lookup tables and matches are copied 16 bytes
+ * at a time. The tables live in the decoder, keep one per thread.
+ */
+class ZlibDecoder {
+public:
+    ZlibDecodeResult Decode(std::span<const u8> input, std::span<u8> output);
+
+    // Main table plus the largest set of subtables a code of up to 15 bits can need.
+    static constexpr std::size_t LitlenTableSize = 2342;
+    static constexpr std::size_t OffsetTableSize = 402;
+    static constexpr std::size_t PrecodeTableSize = 128;
+
+private:
+    class BitReader;
+
+    ZlibDecodeResult ReadDynamicTables(BitReader& reader);
+
+    std::array<u32, LitlenTableSize> litlen_table;
+    std::array<u32, OffsetTableSize> offset_table;
+    std::array<u32, PrecodeTableSize> precode_table;
+};
+
+} // namespace Common
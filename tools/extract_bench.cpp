@@ -0,0 +1,106 @@
+// SPDX-FileCopyrightText: Copyright 2024 shadPS4 Emulator Project
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Times Extractor::Run on one PKG with synchronous I/O and with io_uring, so the two backends
+// can be compared on the same disk. Usage: extract_bench <pkg> <scratch dir> [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <fmt/format.h>
+
+#include "src/async_io.h"
+#include "src/extractor.h"
+#include "src/pkg.h"
+
+namespace {
+
+// Extracts the PKG into a fresh directory below out_root and returns the seconds spent in
+// Extractor::Run, or a negative value if the extraction failed.
+double TimeRun(const std::filesystem::path& pkg_path, const std::filesystem::path& out_root,
+               const ExtractorConfig& config, u64& bytes) {
+    std::error_code ec;
+    std::filesystem::remove_all(out_root, ec);
+
+    PKG pkg;
+    std::string failreason;
+    if (!pkg.Open(pkg_path, failreason)) {
+        fmt::print(stderr, "Failed to open {}: {}\n", pkg_path.string(), failreason);
+        return -1.0;
+    }
+    // Extract puts the game in a title ID folder next to the given path unless the path
+    // already ends in one, so pass it that way to keep every file below out_root.
+    const auto out_dir = out_root / pkg.GetTitleID();
+    std::filesystem::create_directories(out_dir, ec);
+    if (!pkg.Extract(pkg_path, out_dir, failreason)) {
+        fmt::print(stderr, "Failed to extract {}: {}\n", pkg_path.string(), failreason);
+        return -1.0;
+    }
+
+    bytes = 0;
+    for (const u64 size : pkg.GetExtractionPlan().sizes) {
+        bytes += size;
+    }
+
+    // Drop the PKG from the page cache so every run reads it from the disk. Its pages are
+    // clean, unlike the output, so the advice is enough.
+    {
+        const Common::FS::IOFile file(pkg_path, Common::FS::FileAccessMode::Read);
+        file.Advise(0, file.GetSize(), Common::FS::AccessHint::DontNeed);
+    }
+
+    Extractor extractor(pkg, config);
+    const auto start = std::chrono::steady_clock::now();
+    const bool ok = extractor.Run([](u64) { return true; });
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (!ok) {
+        fmt::print(stderr, "{}\n", extractor.GetError());
+        return -1.0;
+    }
+    return elapsed.count();
+}
+
+} // Anonymous namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fmt::print(stderr, "Usage: {} <pkg> <scratch dir> [runs]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path pkg_path = argv[1];
+    const std::filesystem::path scratch = argv[2];
+    const int runs = argc > 3 ? std::max(1, std::atoi(argv[3])) : 3;
+
+    if (!Common::FS::AsyncIO(1).IsAsync()) {
+        fmt::print("io_uring is unavailable, the async runs use the synchronous fallback\n");
+    }
+
+    for (const bool async : {false, true}) {
+        ExtractorConfig config;
+        config.use_async_io = async;
+        const char* name = async ? "io_uring" : "sync";
+
+        // Every run starts with the PKG out of the page cache, report the best of them.
+        double best = 0.0;
+        u64 bytes = 0;
+        for (int run = 0; run < runs; run++) {
+            const double seconds = TimeRun(pkg_path, scratch / name, config, bytes);
+            if (seconds < 0.0) {
+                return EXIT_FAILURE;
+            }
+            fmt::print("{:>8} run {}: {:.3f} s\n", name, run + 1, seconds);
+            if (run == 0 || seconds < best) {
+                best = seconds;
+            }
+        }
+        fmt::print("{:>8} best: {:.3f} s, {:.1f} MiB/s\n", name, best,
+                   static_cast<double>(bytes) / (1024.0 * 1024.0) / best);
+    }
+
+    std::error_code ec;
+    std::filesystem::remove_all(scratch / "sync", ec);
+    std::filesystem::remove_all(scratch / "io_uring", ec);
+    return EXIT_SUCCESS;
+}